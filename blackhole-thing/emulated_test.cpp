@@ -0,0 +1,173 @@
+// Smoke test for the library's host-side paths, run on the emulated device
+// so it needs no card: block I/O across a 2 MiB window boundary, the cached
+// 2 MiB windows (hit, eviction), and an iATU map/unmap.
+//
+// ctest runs it; it can also be run by hand.  Exits nonzero on the first
+// failure.
+
+#include "blackhole_grid.hpp"
+#include "blackhole_pcie.hpp"
+#include "iatu_region_manager.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "fmt/core.h"
+
+using namespace tt;
+
+#define EXPECT(cond)                                                                                                   \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            fmt::print(stderr, "{}:{}: expected {}\n", __FILE__, __LINE__, #cond);                                     \
+            std::exit(1);                                                                                              \
+        }                                                                                                              \
+    } while (0)
+
+static constexpr uint64_t WINDOW_2M = 1ULL << 21;
+
+static std::vector<uint8_t> pattern(size_t size, uint8_t seed)
+{
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = uint8_t(i * 31 + seed);
+    }
+    return data;
+}
+
+// write()/read() of a block that straddles two 2 MiB windows, checked both
+// ways and through windows on either side of the boundary.
+static void test_block_io(BlackholePciDevice& device, NocXY tile)
+{
+    const uint64_t address = WINDOW_2M - 4096 + 12; // unaligned, both sides
+    const size_t size = 3 * 4096;
+    const auto data = pattern(size, 1);
+
+    device.write(tile.x, tile.y, address, data.data(), data.size());
+
+    std::vector<uint8_t> back(size);
+    device.read(tile.x, tile.y, address, back.data(), back.size());
+    EXPECT(back == data);
+
+    const size_t below = WINDOW_2M - address;
+    auto low = device.map_tlb_2M_UC(tile.x, tile.y, 0);
+    auto high = device.map_tlb_2M_UC(tile.x, tile.y, WINDOW_2M);
+    std::vector<uint8_t> seen(size);
+    low->read_block(address, seen.data(), below);
+    high->read_block(0, seen.data() + below, size - below);
+    EXPECT(seen == data);
+}
+
+// A second lookup of the same page hits; filling the UC pool with uncached
+// windows evicts the idle cached one.  Data survives both.
+static void test_cached_windows(BlackholePciDevice& device, NocXY tile)
+{
+    device.flush_tlb_cache();
+    const uint64_t address = 8 * WINDOW_2M + 256;
+    const auto data = pattern(64, 2);
+
+    for (bool wc : {true, false}) {
+        auto map = [&] {
+            return wc ? device.map_tlb_2M_WC_cached(tile.x, tile.y, address)
+                      : device.map_tlb_2M_UC_cached(tile.x, tile.y, address);
+        };
+
+        const TlbCacheStats before = device.get_tlb_cache_stats();
+        map()->write_block(0, data.data(), data.size());
+
+        std::vector<uint8_t> back(data.size());
+        map()->read_block(0, back.data(), back.size());
+        EXPECT(back == data);
+
+        const TlbCacheStats after = device.get_tlb_cache_stats();
+        EXPECT(after.misses == before.misses + 1);
+        EXPECT(after.hits == before.hits + 1);
+    }
+
+    // The UC window cached above is idle; take every UC window there is.
+    const uint64_t evictions = device.get_tlb_cache_stats().evictions;
+    std::vector<std::unique_ptr<TlbWindow>> uncached;
+    while (device.get_tlb_cache_stats().evictions == evictions) {
+        EXPECT(uncached.size() < 64);
+        uncached.push_back(device.map_tlb_2M_UC(tile.x, tile.y, 0));
+    }
+    uncached.clear();
+
+    const uint64_t misses = device.get_tlb_cache_stats().misses;
+    std::vector<uint8_t> back(data.size());
+    device.map_tlb_2M_UC_cached(tile.x, tile.y, address)->read_block(0, back.data(), back.size());
+    EXPECT(back == data);
+    EXPECT(device.get_tlb_cache_stats().misses == misses + 1);
+}
+
+// Map two pinned buffers back to back, check the regions programmed for
+// them, and check everything is released on unmap.
+static void test_iatu(BlackholePciDevice& device)
+{
+    static constexpr uint64_t ATU_OFFSET_IN_BH_BAR2 = 0x1200;
+    static constexpr size_t NUM_REGIONS = 16;
+    static constexpr size_t SIZE = 64 * 1024;
+
+    auto region_register = [&](size_t region, uint64_t offset) {
+        return *reinterpret_cast<volatile uint32_t*>(device.get_bar2() + ATU_OFFSET_IN_BH_BAR2 + region * 0x200 +
+                                                     offset);
+    };
+    auto region_target = [&](size_t region) {
+        return region_register(region, 0x14) | (uint64_t(region_register(region, 0x18)) << 32);
+    };
+    auto region_enabled = [&](size_t region) { return (region_register(region, 0x04) >> 31) & 1; };
+
+    // Two pieces with a gap between them, so they can't merge into one region.
+    std::vector<uint8_t> buffer(4 * SIZE);
+    uint8_t* aligned = reinterpret_cast<uint8_t*>((uintptr_t(buffer.data()) + SIZE - 1) & ~uintptr_t(SIZE - 1));
+    std::vector<IovaExtent> extents = {
+        {device.map_for_dma(aligned, SIZE), SIZE},
+        {device.map_for_dma(aligned + 2 * SIZE, SIZE), SIZE},
+    };
+
+    IatuRegionManager iatu(device);
+    const size_t free_before = iatu.free_regions();
+    {
+        auto mapping = iatu.map(extents);
+        EXPECT(mapping->size() == 2 * SIZE);
+        EXPECT(mapping->get_num_regions() == 2);
+        EXPECT(iatu.free_regions() + mapping->get_num_regions() == free_before);
+
+        for (const IovaExtent& extent : extents) {
+            bool found = false;
+            for (size_t region = 0; region < NUM_REGIONS; ++region) {
+                found |= region_enabled(region) && region_target(region) == extent.iova;
+            }
+            EXPECT(found);
+        }
+
+        // Same extents again share the regions.
+        auto again = iatu.map(extents);
+        EXPECT(again->get_device_address() == mapping->get_device_address());
+        EXPECT(iatu.free_regions() + mapping->get_num_regions() == free_before);
+    }
+
+    EXPECT(iatu.free_regions() == free_before);
+    for (size_t region = 0; region < NUM_REGIONS; ++region) {
+        EXPECT(!region_enabled(region));
+    }
+
+    for (const IovaExtent& extent : extents) {
+        device.unmap_for_dma(extent.iova);
+    }
+}
+
+int main()
+{
+    BlackholePciDevice device(BlackholePciDevice::EMULATED);
+    const NocXY tile = Blackhole::DRAM_LOCATIONS[0][0];
+
+    test_block_io(device, tile);
+    test_cached_windows(device, tile);
+    test_iatu(device);
+
+    fmt::print("ok\n");
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include "blackhole_pcie.hpp"
+#include "dma_buffer.hpp"
 #include "pcie_core.hpp"
 #include "utility.hpp"
+#include <chrono>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -46,14 +48,28 @@ int test2()
 {
     BlackholePciDevice device("/dev/tenstorrent/0");
     size_t ONE_GIG = 1 << 30;
-    void *buffer = std::aligned_alloc(0x1000, 48*ONE_GIG);
-    uint64_t iova = device.map_for_dma(buffer, 48*ONE_GIG);
-    std::cout << "0x" << std::hex << iova << std::dec << std::endl;
+    DmaBuffer dma_buffer(48*ONE_GIG);
+    void *buffer = dma_buffer.data();
+    std::cout << "Got " << dma_buffer.page_kind_name() << " pages" << std::endl;
+
+    // Pin in the background; the first chunk is usable long before the rest.
+    auto start = std::chrono::steady_clock::now();
+    auto pin = device.map_for_dma_async(buffer, dma_buffer.size());
+    pin->wait_for(1);
+    auto first = std::chrono::steady_clock::now();
+    uint64_t iova = pin->iova(0);
+    std::cout << "0x" << std::hex << iova << std::dec << " usable after "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(first - start).count() << " ms" << std::endl;
     auto window = device.map_tlb_2M_UC(11, 0, iova);
 
     *reinterpret_cast<uint32_t*>(buffer) = 0xdeadbeef;
 
-    std::cout << "0x" << std::hex << window->read32(0) << std::endl;
+    std::cout << "0x" << std::hex << window->read32(0) << std::dec << std::endl;
+
+    pin->wait();
+    auto all = std::chrono::steady_clock::now();
+    std::cout << "All " << pin->chunks().size() << " chunks pinned after "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(all - start).count() << " ms" << std::endl;
     return 0;
 }
 
@@ -90,9 +106,10 @@ int main(int argc, char** argv)
     auto iova = device.map_for_dma(dma_buffer, size);
     std::cout << "IOVA is: 0x" << iova << std::endl;
 
-    // Configure PCIe using NOC->PCIe TLB index 0 to disable hw addr translation
+    // Get a NOC->PCIe TLB entry that disables hw addr translation
     PCIeCore pcie_noc_core(device, PCIE_EP_X, PCIE_EP_Y);
-    auto pcie_addr = pcie_noc_core.configure_noc_tlb_data(0, NocTlbData{.atu_bypass = 1});
+    auto outbound = pcie_noc_core.map_outbound(OutboundTlbConfig::strict());
+    auto pcie_addr = outbound->get_noc_address();
     std::cout << "Base of IOVA address space in PCIe core is 0x" << pcie_addr << std::endl;
 
     // The address needed by the NOC to access the buffer through the PCIe core
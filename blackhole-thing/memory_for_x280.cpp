@@ -5,7 +5,10 @@
 #include <unistd.h>
 #include <system_error>
 
+#include "async_dma_pin.hpp"
 #include "blackhole_pcie.hpp"
+#include "dma_buffer.hpp"
+#include "iatu_region_manager.hpp"
 #include "l2cpu_core.hpp"
 #include "pcie_core.hpp"
 
@@ -21,36 +24,6 @@
 
 using namespace tt;
 
-class PageAlignedBuffer {
-public:
-    explicit PageAlignedBuffer(size_t size) {
-        size_t page_size = 4096;
-        size_ = (size + page_size - 1) & ~(page_size - 1);
-
-        void* ptr = nullptr;
-        if (posix_memalign(&ptr, page_size, size_) != 0) {
-            throw std::runtime_error("Failed to allocate aligned buffer");
-        }
-        buffer_ = ptr;
-    }
-
-    ~PageAlignedBuffer() {
-        free(buffer_);
-    }
-
-    void* data() { return buffer_; }
-    const void* data() const { return buffer_; }
-    size_t size() const { return size_; }
-
-    // Prevent copying
-    PageAlignedBuffer(const PageAlignedBuffer&) = delete;
-    PageAlignedBuffer& operator=(const PageAlignedBuffer&) = delete;
-
-private:
-    void* buffer_;
-    size_t size_;
-};
-
 static constexpr size_t L2CPU_X = 8;
 static constexpr size_t L2CPU_Y = 3;
 static constexpr size_t PCIE_X = 11;
@@ -145,10 +118,10 @@ int wtf()
 
     // map X280 TLBs to the other X280's DRAM
     uint64_t mem_port = 0x0000'3000'0000ULL;
-    uint64_t address_128G = x280.configure_noc_tlb_128G(0, OTHER_L2CPU_X, OTHER_L2CPU_Y, mem_port);
-    uint64_t address_2M = x280.configure_noc_tlb_2M(0, OTHER_L2CPU_X, OTHER_L2CPU_Y, mem_port);
-    fmt::print("Other X280 DRAM mapped to (128G) {:#x} in X280 address space\n", address_128G);
-    fmt::print("Other X280 DRAM mapped to (2M) {:#x} in X280 address space\n", address_2M);
+    auto window_128G = x280.map_noc_tlb_128G(OTHER_L2CPU_X, OTHER_L2CPU_Y, mem_port);
+    auto window_2M = x280.map_noc_tlb_2M(OTHER_L2CPU_X, OTHER_L2CPU_Y, mem_port);
+    fmt::print("Other X280 DRAM mapped to (128G) {:#x} in X280 address space\n", window_128G->get_x280_address());
+    fmt::print("Other X280 DRAM mapped to (2M) {:#x} in X280 address space\n", window_2M->get_x280_address());
 
 
     return 0;
@@ -171,15 +144,21 @@ int main(int argc, char** argv) {
         auto file_size = std::filesystem::file_size(filepath);
 
         std::cout << "Allocating buffer of size " << file_size << std::endl;
-        auto buffer = PageAlignedBuffer(file_size);
-        std::cout << "... done" << std::endl;
+        DmaBuffer buffer(file_size);
+        std::cout << "... done, " << buffer.size() << " bytes of " << buffer.page_kind_name() << " pages" << std::endl;
+
+        // Pin in at most one chunk per iATU region, so a buffer of tens of GiB
+        // doesn't need one contiguous IOVA allocation.  1 GiB multiples suit
+        // any page size the buffer might have.
+        const size_t chunk_granule = 1ULL << 30;
+        const size_t regions = IatuRegionManager::NUM_REGIONS;
+        const size_t per_region = (buffer.size() + regions - 1) / regions;
+        const size_t chunk_size = (per_region + chunk_granule - 1) / chunk_granule * chunk_granule;
 
         std::cout << "IOMMU mapping buffer" << std::endl;
-        uint64_t iova = device.map_for_dma(buffer.data(), buffer.size());
-        if (iova == 0) {
-            throw std::runtime_error("Failed to map buffer for DMA");
-        }
-        std::cout << "... done" << std::endl;
+        AsyncDmaPin pin(device, buffer.data(), buffer.size(), chunk_size);
+        pin.wait();
+        std::cout << "... done, " << pin.chunks().size() << " chunks" << std::endl;
 
         std::cout << "Reading file into buffer" << std::endl;
         std::ifstream file(filepath, std::ios::binary);
@@ -190,15 +169,18 @@ int main(int argc, char** argv) {
         std::cout << "... done" << std::endl;
 
         std::cout << "iATU..." << std::endl;
-        device.configure_iatu_region(0, 0, iova, buffer.size());
-        std::cout << "... done" << std::endl;
-
-        // 4th NOC->PCIe window does not bypass ATU.
-        // We need ATU because the IOVA is not predictable.
-        // But the address I have in my X280 device tree for pmem is fixed.
-        uint64_t pcie_addr = (4ULL << 58);
-
-        // TODO: magic zero
+        IatuRegionManager iatu(device);
+        auto mapping = iatu.map(pin);
+        std::cout << "... done, " << mapping->get_num_regions() << " regions" << std::endl;
+
+        // This NOC->PCIe window does not bypass ATU.
+        // We need ATU because the IOVAs are not predictable.
+        // But the address I have in my X280 device tree for pmem is fixed,
+        // which works out because the first mapping starts at 0.
+        uint64_t pcie_addr = (uint64_t(PCIeCore::IATU_TLB_INDEX) << 58) + mapping->get_device_address();
+
+        // Index 0 rather than map_noc_tlb_128G: the pmem address in the X280
+        // device tree is the base of that window.
         std::cout << "X280/NOC TLB..." << std::endl;
         auto x280_addr = x280.configure_noc_tlb_128G(0, PCIE_X, PCIE_Y, pcie_addr);
         std::cout << "Buffer mapped at 0x" << std::hex << x280_addr << std::dec
@@ -209,7 +191,7 @@ int main(int argc, char** argv) {
         // kick the card off the PCIe bus so I can power cycle it.
         // Great news, that's fixed!
 
-        std::cout << "OK, you can use it.\nIOVA: 0x" << std::hex << iova << std::endl;
+        std::cout << "OK, you can use it.\nIOVA: 0x" << std::hex << pin.iova(0) << std::endl;
         std::cout << "X280: 0x" << x280_addr << std::endl;
 
         pause();
@@ -1,77 +1,308 @@
 #include "blackhole_pcie.hpp"
-#include "atomic.hpp"
+#include "mmio_copy.hpp"
 #include "utility.hpp"
 #include "fmt/core.h"
-#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
 #include <string>
-#include <iostream>
+#include <thread>
+#include <vector>
 
 using namespace tt;
 static constexpr size_t DRAM_X = 9;
 static constexpr size_t DRAM_Y = 6;
 
+// Misaligned runs start this far into the window.  Dword aligned, so UC
+// windows still see whole 32-bit accesses, but off the 64-byte line.
+static constexpr size_t MISALIGNMENT = 4;
 
-class Timestamp {
-    std::chrono::steady_clock::time_point start;
+struct WindowType
+{
+    const char* name;
+    std::function<std::unique_ptr<TlbWindow>(BlackholePciDevice&, uint64_t)> map;
+};
+
+// Each thread gets its own window.  2M windows are spread across the tile's
+// address space so threads don't share a page; 4G windows all point at 0.
+static const std::vector<WindowType> WINDOW_TYPES = {
+    {"2M_WC", [](BlackholePciDevice& device, uint64_t addr) { return device.map_tlb_2M_WC(DRAM_X, DRAM_Y, addr); }},
+    {"2M_UC", [](BlackholePciDevice& device, uint64_t addr) { return device.map_tlb_2M_UC(DRAM_X, DRAM_Y, addr); }},
+    {"4G", [](BlackholePciDevice& device, uint64_t) { return device.map_tlb_4G(DRAM_X, DRAM_Y, 0); }},
+};
+
+struct Options
+{
+    size_t min_size = 4;
+    size_t max_size = 512 * 1024 * 1024;
+    size_t max_threads = 1;
+    size_t trials = 10;
+    size_t warmup = 2;
+    std::string format = "text"; // text, csv, json
+    std::string window = "all";
+    std::string kernel = "default"; // default, all, or a kernel name
+};
+
+struct Result
+{
+    std::string window;
+    std::string kernel;
+    std::string direction;
+    size_t size;
+    size_t offset;
+    size_t threads;
+    uint64_t min_ns;
+    uint64_t median_ns;
+    uint64_t p99_ns;
+
+    // All threads move `size` bytes; throughput is for all of them together.
+    double mib_per_sec(uint64_t ns) const { return (threads * size / (1024.0 * 1024.0)) / (ns / 1e9); }
+};
+
+static void usage(const char* argv0)
+{
+    fmt::print("Usage: {} [options]\n", argv0);
+    fmt::print("  --min-size BYTES    smallest transfer, nonzero (default 4)\n");
+    fmt::print("  --max-size BYTES    largest transfer (default 512 MiB, capped at window size)\n");
+    fmt::print("                      each thread allocates a host buffer of the largest size run\n");
+    fmt::print("  --threads N         sweep 1, 2, 4, ... N threads (default 1)\n");
+    fmt::print("  --trials N          timed repetitions per case (default 10)\n");
+    fmt::print("  --warmup N          untimed repetitions per case (default 2)\n");
+    fmt::print("  --window NAME       2M_WC, 2M_UC, 4G or all (default all)\n");
+    fmt::print("  --kernel NAME       copy kernel name, all, or default (what read/write use)\n");
+    fmt::print("  --format FORMAT     text, csv or json (default text)\n");
+}
+
+static Options parse_options(int argc, char** argv)
+{
+    Options options;
+
+    parse_command_line(argc, argv, {}, [&](const std::string& arg, const std::string& value) {
+        if (arg == "--min-size") {
+            options.min_size = std::stoull(value, nullptr, 0);
+        } else if (arg == "--max-size") {
+            options.max_size = std::stoull(value, nullptr, 0);
+        } else if (arg == "--threads") {
+            options.max_threads = std::stoull(value);
+        } else if (arg == "--trials") {
+            options.trials = std::max<size_t>(1, std::stoull(value));
+        } else if (arg == "--warmup") {
+            options.warmup = std::stoull(value);
+        } else if (arg == "--window") {
+            options.window = value;
+        } else if (arg == "--kernel") {
+            options.kernel = value;
+        } else if (arg == "--format") {
+            options.format = value;
+        } else {
+            return false;
+        }
+        return true;
+    }, usage);
 
-public:
-    Timestamp() : start(std::chrono::steady_clock::now()) {}
+    if (options.min_size == 0) {
+        fmt::print(stderr, "--min-size must be nonzero\n");
+        std::exit(1);
+    }
 
-    void reset() { start = std::chrono::steady_clock::now(); }
+    return options;
+}
+
+static std::vector<MmioCopyKernel> selected_kernels(const std::string& name)
+{
+    if (name == "default") {
+        return {mmio_copy_kernel()};
+    }
 
-    uint64_t nanoseconds() const {
-        auto now = std::chrono::steady_clock::now();
-        return std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+    std::vector<MmioCopyKernel> kernels;
+    for (const auto& kernel : mmio_copy_kernels()) {
+        if (name == "all" || name == kernel.name) {
+            kernels.push_back(kernel);
+        }
+    }
+    if (kernels.empty()) {
+        throw std::invalid_argument("Unknown kernel " + name);
     }
+    return kernels;
+}
+
+// Runs one copy per thread, all released at once, and returns the time from
+// release until the slowest thread finished.
+template <class CopyFn> static uint64_t timed_run(size_t num_threads, CopyFn copy)
+{
+    std::vector<uint64_t> ns(num_threads);
+    std::vector<std::thread> threads;
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
 
-    uint64_t microseconds() const {
-        auto now = std::chrono::steady_clock::now();
-        return std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+    for (size_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back([&, i]() {
+            ready.fetch_add(1, std::memory_order_acq_rel);
+            while (!go.load(std::memory_order_acquire)) {
+            }
+
+            Timer timer;
+            copy(i);
+            ns[i] = timer.elapsed_ns();
+        });
     }
 
-    uint64_t milliseconds() const {
-        auto now = std::chrono::steady_clock::now();
-        return std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+    while (ready.load(std::memory_order_acquire) != num_threads) {
     }
+    go.store(true, std::memory_order_release);
 
-    uint64_t seconds() const {
-        auto now = std::chrono::steady_clock::now();
-        return std::chrono::duration_cast<std::chrono::seconds>(now - start).count();
+    for (auto& thread : threads) {
+        thread.join();
     }
 
-    std::string to_string() const {
-        auto ns = nanoseconds();
-        if (ns < 1000) {
-            return fmt::format("{} ns", ns);
-        }
-        auto us = microseconds();
-        if (us < 1000) {
-            return fmt::format("{} μs", us);
-        }
-        auto ms = milliseconds();
-        if (ms < 1000) {
-            return fmt::format("{} ms", ms);
+    return *std::max_element(ns.begin(), ns.end());
+}
+
+template <class CopyFn> static void measure(const Options& options, Result& result, CopyFn copy)
+{
+    std::vector<uint64_t> samples;
+
+    // Single-threaded runs skip the thread spawn; it would swamp small sizes.
+    auto sample = [&]() -> uint64_t {
+        if (result.threads > 1) {
+            return timed_run(result.threads, copy);
         }
-        return fmt::format("{} s", seconds());
+        Timer timer;
+        copy(0);
+        return timer.elapsed_ns();
+    };
+
+    for (size_t i = 0; i < options.warmup; ++i) {
+        sample();
     }
-};
+    for (size_t i = 0; i < options.trials; ++i) {
+        samples.push_back(sample());
+    }
+
+    std::sort(samples.begin(), samples.end());
+    result.min_ns = samples.front();
+    result.median_ns = samples[samples.size() / 2];
+    result.p99_ns = samples[std::min(samples.size() - 1, (samples.size() * 99 + 99) / 100 - 1)];
+}
+
+static void print_header(const Options& options)
+{
+    if (options.format == "csv") {
+        fmt::print("window,kernel,direction,size,offset,threads,min_ns,median_ns,p99_ns,max_mib_s,median_mib_s\n");
+    } else if (options.format == "json") {
+        fmt::print("[\n");
+    } else {
+        fmt::print("{:<6} {:<8} {:<5} {:>10} {:>3} {:>3} {:>12} {:>12} {:>12} {:>10} {:>10}\n", "window", "kernel",
+                   "dir", "size", "off", "thr", "min ns", "median ns", "p99 ns", "max MiB/s", "med MiB/s");
+    }
+}
+
+static void print_result(const Options& options, const Result& r, bool first)
+{
+    const double best = r.mib_per_sec(r.min_ns);
+    const double median = r.mib_per_sec(r.median_ns);
+
+    if (options.format == "csv") {
+        fmt::print("{},{},{},{},{},{},{},{},{},{:.2f},{:.2f}\n", r.window, r.kernel, r.direction, r.size, r.offset,
+                   r.threads, r.min_ns, r.median_ns, r.p99_ns, best, median);
+    } else if (options.format == "json") {
+        fmt::print("{}  {{\"window\": \"{}\", \"kernel\": \"{}\", \"direction\": \"{}\", \"size\": {}, "
+                   "\"offset\": {}, \"threads\": {}, \"min_ns\": {}, \"median_ns\": {}, \"p99_ns\": {}, "
+                   "\"max_mib_s\": {:.2f}, \"median_mib_s\": {:.2f}}}",
+                   first ? "" : ",\n", r.window, r.kernel, r.direction, r.size, r.offset, r.threads, r.min_ns,
+                   r.median_ns, r.p99_ns, best, median);
+    } else {
+        fmt::print("{:<6} {:<8} {:<5} {:>10} {:>3} {:>3} {:>12} {:>12} {:>12} {:>10.2f} {:>10.2f}\n", r.window,
+                   r.kernel, r.direction, r.size, r.offset, r.threads, r.min_ns, r.median_ns, r.p99_ns, best, median);
+    }
+    std::fflush(stdout);
+}
+
+static void print_footer(const Options& options)
+{
+    if (options.format == "json") {
+        fmt::print("\n]\n");
+    }
+}
 
 int main(int argc, char** argv)
 {
-    BlackholePciDevice device("/dev/tenstorrent/0");
-    const size_t one_gig = 1 << 30;
-    std::vector<uint8_t> buffer(4 * one_gig);   // cover the full window
-    auto tlb_window = device.map_tlb_4G(DRAM_X, DRAM_Y, 0);
-
-    for (size_t size = 4; size <= 512 * 1024 * 1024; size *= 2) {
-        Timestamp ts;
-        tlb_window->read_block(0, buffer.data(), size);
-        auto usec = ts.microseconds();
-
-        double mib_per_sec = (size / (1024.0 * 1024.0)) / (usec / 1e6);
-        fmt::print("Read {} bytes in {} us ({:.2f} MiB/s)\n", size, usec, mib_per_sec);
+    const Options options = parse_options(argc, argv);
+    const auto kernels = selected_kernels(options.kernel);
+
+    BlackholePciDevice device(device_path());
+    bool first = true;
+
+    print_header(options);
+
+    for (size_t num_threads = 1; num_threads <= options.max_threads; num_threads *= 2) {
+        for (const auto& window_type : WINDOW_TYPES) {
+            if (options.window != "all" && options.window != window_type.name) {
+                continue;
+            }
+
+            std::vector<std::unique_ptr<TlbWindow>> windows;
+            try {
+                for (size_t i = 0; i < num_threads; ++i) {
+                    windows.push_back(window_type.map(device, i << 21));
+                }
+            } catch (const std::runtime_error&) {
+                // Not enough windows of this type for this many threads.
+                continue;
+            }
+
+            const size_t window_size = windows.front()->size();
+            const size_t max_size = std::min(options.max_size, window_size);
+
+            // The sweep doubles from min_size, so it may stop well short of
+            // max_size; only allocate what it will actually touch.
+            size_t largest_size = 0;
+            for (size_t size = options.min_size; size <= max_size; size *= 2) {
+                largest_size = size;
+            }
+            if (largest_size == 0) {
+                continue;
+            }
+
+            // Host side is 64-byte aligned, then misaligned by the same amount
+            // as the device side.
+            std::vector<std::vector<uint8_t>> storage;
+            std::vector<uint8_t*> buffers;
+            for (size_t i = 0; i < num_threads; ++i) {
+                auto& bytes = storage.emplace_back(largest_size + MISALIGNMENT + 64, uint8_t(i));
+                auto aligned = (reinterpret_cast<uintptr_t>(bytes.data()) + 63) & ~uintptr_t(63);
+                buffers.push_back(reinterpret_cast<uint8_t*>(aligned));
+            }
+
+            for (const auto& kernel : kernels) {
+                for (size_t size = options.min_size; size <= largest_size; size *= 2) {
+                    for (size_t offset : {size_t(0), MISALIGNMENT}) {
+                        // A full-window transfer has no room to be misaligned.
+                        if (offset + size > window_size) {
+                            continue;
+                        }
+
+                        Result result{window_type.name, kernel.name, "read", size, offset, num_threads, 0, 0, 0};
+                        measure(options, result, [&](size_t i) {
+                            kernel.read(buffers[i] + offset, windows[i]->as<uint8_t*>() + offset, size);
+                        });
+                        print_result(options, result, first);
+                        first = false;
+
+                        result.direction = "write";
+                        measure(options, result, [&](size_t i) {
+                            kernel.write(windows[i]->as<uint8_t*>() + offset, buffers[i] + offset, size);
+                        });
+                        print_result(options, result, false);
+                    }
+                }
+            }
+        }
     }
 
+    print_footer(options);
 
     return 0;
-}
\ No newline at end of file
+}
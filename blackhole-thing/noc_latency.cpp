@@ -0,0 +1,223 @@
+#include "blackhole_grid.hpp"
+#include "blackhole_pcie.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+
+using namespace tt;
+
+// Histogram buckets are BUCKET_NS wide; the last bucket collects the rest.
+static constexpr uint64_t BUCKET_NS = 100;
+static constexpr size_t NUM_BUCKETS = 64;
+
+// What to poke on each kind of tile.  Only Tensix L1 is ever written, and
+// only with --write: DRAM may belong to a running X280, and the L2CPU and PCIe
+// addresses are live registers.  Writes put back the value that was just read,
+// which is harmless unless something else writes the same word in between.
+struct TileKind
+{
+    const char* name;
+    uint64_t address;
+    bool writable;
+};
+
+static constexpr TileKind TENSIX_TILE{"tensix", 0x0, true};                     // L1
+static constexpr TileKind DRAM_TILE{"dram", 0x0, false};                        // DRAM
+static constexpr TileKind L2CPU_TILE{"l2cpu", 0xFFFF'F7FE'FFF0'0000ULL, false}; // NOC TLB config
+static constexpr TileKind PCIE_TILE{"pcie", 0xFFFF'FFFF'F000'0000ULL, false};   // SII registers
+
+struct Tile
+{
+    NocXY xy;
+    const TileKind* kind;
+};
+
+struct Latency
+{
+    std::vector<uint64_t> samples;
+    std::array<uint64_t, NUM_BUCKETS> histogram{};
+
+    void add(uint64_t ns)
+    {
+        samples.push_back(ns);
+        histogram[std::min<size_t>(ns / BUCKET_NS, NUM_BUCKETS - 1)]++;
+    }
+
+    // Call after the last add().
+    void finish() { std::sort(samples.begin(), samples.end()); }
+
+    uint64_t percentile(size_t p) const
+    {
+        if (samples.empty()) {
+            return 0;
+        }
+        return samples[std::min(samples.size() - 1, samples.size() * p / 100)];
+    }
+};
+
+struct TileResult
+{
+    Tile tile;
+    Latency read;
+    Latency write; // write32 followed by read32 of the same word
+};
+
+static std::vector<Tile> all_tiles()
+{
+    std::vector<Tile> tiles;
+    for (const auto& xy : Blackhole::TENSIX_LOCATIONS) {
+        tiles.push_back({xy, &TENSIX_TILE});
+    }
+    for (const auto& channel : Blackhole::DRAM_LOCATIONS) {
+        for (const auto& xy : channel) {
+            tiles.push_back({xy, &DRAM_TILE});
+        }
+    }
+    for (const auto& xy : Blackhole::L2CPU_LOCATIONS) {
+        tiles.push_back({xy, &L2CPU_TILE});
+    }
+    for (const auto& xy : Blackhole::PCIE_LOCATIONS) {
+        tiles.push_back({xy, &PCIE_TILE});
+    }
+    return tiles;
+}
+
+static void measure(BlackholePciDevice& device, TileResult& result, size_t samples, bool writes)
+{
+    const Tile& tile = result.tile;
+    auto window = device.map_tlb_2M_UC(tile.xy.x, tile.xy.y, tile.kind->address);
+
+    // Warm up: the first access after programming the window is not typical.
+    uint32_t value = window->read32(0);
+
+    for (size_t i = 0; i < samples; ++i) {
+        Timer timer;
+        value = window->read32(0);
+        result.read.add(timer.elapsed_ns());
+    }
+
+    for (size_t i = 0; writes && tile.kind->writable && i < samples; ++i) {
+        Timer timer;
+        window->write32(0, value);
+        value = window->read32(0);
+        result.write.add(timer.elapsed_ns());
+    }
+
+    result.read.finish();
+    result.write.finish();
+}
+
+// One cell per tile, median latency in ns; "." where nothing was measured.
+static void print_heatmap(const char* title, const std::vector<TileResult>& results, bool write)
+{
+    std::array<std::array<uint64_t, Blackhole::GRID_WIDTH>, Blackhole::GRID_HEIGHT> grid{};
+
+    for (const auto& result : results) {
+        const Latency& latency = write ? result.write : result.read;
+        grid[result.tile.xy.y][result.tile.xy.x] = latency.percentile(50);
+    }
+
+    fmt::print("{} (median ns)\n", title);
+    fmt::print("    ");
+    for (size_t x = 0; x < Blackhole::GRID_WIDTH; ++x) {
+        fmt::print("{:>6}", x);
+    }
+    fmt::print("\n");
+
+    for (size_t y = 0; y < Blackhole::GRID_HEIGHT; ++y) {
+        fmt::print("{:>3} ", y);
+        for (size_t x = 0; x < Blackhole::GRID_WIDTH; ++x) {
+            if (grid[y][x]) {
+                fmt::print("{:>6}", grid[y][x]);
+            } else {
+                fmt::print("{:>6}", ".");
+            }
+        }
+        fmt::print("\n");
+    }
+    fmt::print("\n");
+}
+
+static void write_csv(const std::string& path, const std::vector<TileResult>& results)
+{
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+
+    fmt::print(file, "x,y,kind,op,samples,min_ns,p50_ns,p90_ns,p99_ns,max_ns");
+    for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+        fmt::print(file, ",h{}", i * BUCKET_NS);
+    }
+    fmt::print(file, "\n");
+
+    for (const auto& result : results) {
+        for (const auto* op : {"read", "write"}) {
+            const Latency& latency = std::string(op) == "read" ? result.read : result.write;
+            if (latency.samples.empty()) {
+                continue;
+            }
+
+            fmt::print(file, "{},{},{},{},{},{},{},{},{},{}", result.tile.xy.x, result.tile.xy.y,
+                       result.tile.kind->name, op, latency.samples.size(), latency.samples.front(),
+                       latency.percentile(50), latency.percentile(90), latency.percentile(99),
+                       latency.samples.back());
+            for (auto count : latency.histogram) {
+                fmt::print(file, ",{}", count);
+            }
+            fmt::print(file, "\n");
+        }
+    }
+
+    std::fclose(file);
+}
+
+int main(int argc, char** argv)
+{
+    size_t samples = 1000;
+    bool writes = false;
+    std::string csv_path = "noc_latency.csv";
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--samples" && i + 1 < argc) {
+            samples = std::stoul(argv[++i]);
+        } else if (arg == "--csv" && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else if (arg == "--write") {
+            writes = true;
+        } else {
+            fmt::print("Usage: {} [--samples N] [--csv FILE] [--write]\n", argv[0]);
+            fmt::print("  Times read32 round trips to every Tensix, DRAM, L2CPU and PCIe tile.  With\n");
+            fmt::print("  --write, also times write32+read32 to Tensix L1 (other tiles stay read-only).\n");
+            fmt::print("  Histograms ({} ns buckets) go to the CSV, default noc_latency.csv.\n", BUCKET_NS);
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+
+    BlackholePciDevice device(device_path());
+    std::vector<TileResult> results;
+
+    for (const auto& tile : all_tiles()) {
+        results.push_back(TileResult{tile, {}, {}});
+        measure(device, results.back(), samples, writes);
+    }
+
+    print_heatmap("read32", results, false);
+    if (writes) {
+        print_heatmap("write32 + read32", results, true);
+    }
+
+    write_csv(csv_path, results);
+    fmt::print("Wrote {}\n", csv_path);
+
+    return 0;
+}
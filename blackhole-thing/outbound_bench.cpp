@@ -0,0 +1,176 @@
+#include "atomic.hpp"
+#include "blackhole_pcie.hpp"
+#include "dma_buffer.hpp"
+#include "l2cpu_core.hpp"
+#include "l2cpu_dma.hpp"
+#include "pcie_core.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+
+using namespace tt;
+
+static constexpr uint32_t PCIE_X = 2;
+static constexpr uint32_t PCIE_Y = 0;
+static constexpr uint32_t L2CPU_X = 8;
+static constexpr uint32_t L2CPU_Y = 3;
+static constexpr uint64_t X280_DDR_BASE = 0x4000'3000'0000ULL;
+
+struct Options
+{
+    uint32_t pcie_x = PCIE_X;
+    uint32_t pcie_y = PCIE_Y;
+    uint32_t l2cpu_x = L2CPU_X;
+    uint32_t l2cpu_y = L2CPU_Y;
+    uint64_t dram_offset = L2CPU::BENCH_SCRATCH_OFFSET;
+    uint32_t traffic_class = 0;
+    size_t trials = 10;
+    size_t max_size = 2ULL << 20;
+    std::string initiator = "dmac"; // dmac, host
+    bool verify = false;
+};
+
+static void usage(const char* argv0)
+{
+    fmt::print("Usage: {} [options]\n", argv0);
+    fmt::print("  Device-to-host write bandwidth through the PCIe core's outbound TLB, with strict\n");
+    fmt::print("  and relaxed ordering, with and without no-snoop.\n");
+    fmt::print("  Reprograms the L2CPU's NOC TLBs and overwrites its DRAM: don't run it while\n");
+    fmt::print("  that L2CPU's X280s are running Linux.\n\n");
+    fmt::print("  --pcie X,Y          PCIe core connected to this host (default {},{})\n", PCIE_X, PCIE_Y);
+    fmt::print("  --l2cpu X,Y         L2CPU whose DMAC does the writes (default {},{})\n", L2CPU_X, L2CPU_Y);
+    fmt::print("  --dram OFFSET       2 MiB source area in X280 DRAM, overwritten (default {:#x})\n",
+               L2CPU::BENCH_SCRATCH_OFFSET);
+    fmt::print("  --tc N              PCIe traffic class for every case (default 0)\n");
+    fmt::print("  --trials N          timed repetitions per case (default 10)\n");
+    fmt::print("  --max-size BYTES    largest transfer (default 2 MiB, at most 2 MiB)\n");
+    fmt::print("  --initiator NAME    dmac: the L2CPU DMAC writes to host memory (default)\n");
+    fmt::print("                      host: the host writes through the PCIe core back to itself\n");
+    fmt::print("  --verify            check the data that arrived in host memory\n");
+}
+
+static Options parse_options(int argc, char** argv)
+{
+    Options options;
+
+    parse_command_line(argc, argv, {"--verify"}, [&](const std::string& arg, const std::string& value) {
+        if (arg == "--verify") {
+            options.verify = true;
+        } else if (arg == "--pcie") {
+            return parse_xy(value, options.pcie_x, options.pcie_y);
+        } else if (arg == "--l2cpu") {
+            return parse_xy(value, options.l2cpu_x, options.l2cpu_y);
+        } else if (arg == "--dram") {
+            options.dram_offset = std::stoull(value, nullptr, 0);
+        } else if (arg == "--tc") {
+            options.traffic_class = std::stoul(value) & 0x7;
+        } else if (arg == "--trials") {
+            options.trials = std::max<size_t>(1, std::stoull(value));
+        } else if (arg == "--max-size") {
+            options.max_size = std::min<size_t>(2ULL << 20, std::stoull(value, nullptr, 0));
+            return options.max_size != 0;
+        } else if (arg == "--initiator") {
+            options.initiator = value;
+            return value == "dmac" || value == "host";
+        } else {
+            return false;
+        }
+        return true;
+    }, usage);
+
+    return options;
+}
+
+struct Case
+{
+    const char* name;
+    OutboundTlbConfig config;
+};
+
+static std::vector<Case> cases(uint32_t traffic_class)
+{
+    OutboundTlbConfig strict_ns = OutboundTlbConfig::strict();
+    OutboundTlbConfig relaxed_ns = OutboundTlbConfig::relaxed();
+    strict_ns.no_snoop = true;
+    relaxed_ns.no_snoop = true;
+
+    return {
+        {"strict", OutboundTlbConfig::strict().with_traffic_class(traffic_class)},
+        {"relaxed", OutboundTlbConfig::relaxed().with_traffic_class(traffic_class)},
+        {"strict+ns", strict_ns.with_traffic_class(traffic_class)},
+        {"relaxed+ns", relaxed_ns.with_traffic_class(traffic_class)},
+    };
+}
+
+int main(int argc, char** argv)
+{
+    Options options = parse_options(argc, argv);
+
+    BlackholePciDevice device(device_path());
+    PCIeCore pcie(device, options.pcie_x, options.pcie_y);
+    L2CPU l2cpu(device, options.l2cpu_x, options.l2cpu_y);
+
+    DmaBuffer host(options.max_size, DmaPageSize::Huge2M);
+    const uint64_t iova = host.map_for_dma(device);
+
+    // What should arrive, staged where each initiator reads from.
+    std::vector<uint8_t> pattern(options.max_size);
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        pattern[i] = uint8_t(i * 7 + 1);
+    }
+    l2cpu.map_dram_2M_WC(options.dram_offset)->write_block(0, pattern.data(), pattern.size());
+    sfence();
+
+    std::unique_ptr<L2CpuDma> dmac;
+    if (options.initiator == "dmac") {
+        dmac = std::make_unique<L2CpuDma>(l2cpu);
+    }
+    const uint64_t src = X280_DDR_BASE + options.dram_offset;
+
+    fmt::print("{:<12} {:>8} {:>10} {:>8}  {}\n", "ordering", "bytes", "median_ns", "GiB/s", options.initiator);
+
+    for (const auto& c : cases(options.traffic_class)) {
+        auto outbound = pcie.map_outbound(c.config);
+        const uint64_t noc_address = outbound->get_noc_address() + iova;
+
+        std::function<void(size_t)> transfer;
+        std::unique_ptr<L2CpuNocWindow> x280_window;
+        std::unique_ptr<TlbWindow> host_window;
+
+        if (dmac) {
+            x280_window = l2cpu.map_noc_tlb_128G(options.pcie_x, options.pcie_y, noc_address);
+            const uint64_t dst = x280_window->get_x280_address();
+            transfer = [&, dst](size_t size) { dmac->wait(dmac->submit(dst, src, size)); };
+        } else {
+            host_window = device.map_tlb_4G(options.pcie_x, options.pcie_y, noc_address);
+            transfer = [&](size_t size) {
+                host_window->write_block(0, pattern.data(), size);
+                sfence();
+                host_window->read32(0); // returns once the writes ahead of it have landed
+            };
+        }
+
+        for (size_t size : size_sweep(4096, options.max_size, 4)) {
+            std::memset(host.data(), 0, size);
+
+            uint64_t ns = median_ns(options.trials, [&] { transfer(size); });
+            double gib_per_sec = (size / double(1ULL << 30)) / (ns / 1e9);
+            fmt::print("{:<12} {:>8} {:>10} {:>8.2f}", c.name, size, ns, gib_per_sec);
+
+            if (options.verify) {
+                bool ok = std::memcmp(host.data(), pattern.data(), size) == 0;
+                fmt::print("  {}", ok ? "ok" : "MISMATCH");
+            }
+            fmt::print("\n");
+        }
+    }
+
+    return 0;
+}
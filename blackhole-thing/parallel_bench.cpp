@@ -0,0 +1,63 @@
+#include "blackhole_pcie.hpp"
+#include "parallel_transfer.hpp"
+#include "utility.hpp"
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fmt/core.h"
+
+using namespace tt;
+
+static constexpr size_t DRAM_X = 9;
+static constexpr size_t DRAM_Y = 6;
+static constexpr size_t ONE_MIB = 1 << 20;
+
+static void print_report(const char* direction, const TransferReport& report)
+{
+    fmt::print("  {}: {:.2f} GiB/s aggregate\n", direction, report.gib_per_sec());
+    for (size_t i = 0; i < report.threads.size(); ++i) {
+        const auto& thread = report.threads[i];
+        fmt::print("    thread {:>2} -> ({}, {}) {:#x}: {} MiB in {} us, {:.2f} GiB/s\n", i, thread.target.x,
+                   thread.target.y, thread.target.address, thread.bytes / ONE_MIB, thread.ns / 1000,
+                   thread.gib_per_sec());
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && std::string(argv[1]) == "-h") {
+        fmt::print("Usage: {} [max_threads] [size_mib] [channels]\n", argv[0]);
+        fmt::print("  channels: stripe across one endpoint of every non-X280 DRAM channel instead of ({}, {})\n", DRAM_X,
+                   DRAM_Y);
+        return 0;
+    }
+
+    size_t max_threads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+    size_t size = (argc > 2 ? std::stoul(argv[2]) : 1024) * ONE_MIB;
+    bool spread = argc > 3 && std::string(argv[3]) == "channels";
+
+    BlackholePciDevice device(device_path());
+    std::vector<NocTarget> targets = spread ? ParallelTransfer::dram_channel_targets(0)
+                                            : std::vector<NocTarget>{{DRAM_X, DRAM_Y, 0}};
+    auto src = random_vec<uint32_t>(size / sizeof(uint32_t));
+    std::vector<uint32_t> dst(src.size());
+    size = src.size() * sizeof(uint32_t);
+
+    for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        ParallelTransfer transfer(device, num_threads);
+
+        fmt::print("{} thread(s), {} MiB, {} target(s)\n", num_threads, size / ONE_MIB, targets.size());
+        print_report("write", transfer.write(targets, src.data(), size));
+        print_report("read", transfer.read(targets, dst.data(), size));
+
+        if (std::memcmp(src.data(), dst.data(), size) != 0) {
+            fmt::print("  readback mismatch!\n");
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include "atomic.hpp"
+#include "blackhole_grid.hpp"
+#include "blackhole_pcie.hpp"
+#include "l2cpu_core.hpp"
+#include "l2cpu_dma.hpp"
+#include "pcie_core.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+
+using namespace tt;
+
+static constexpr uint32_t PCIE_X = 2;
+static constexpr uint32_t PCIE_Y = 0;
+static constexpr uint32_t L2CPU_X = 8;
+static constexpr uint32_t L2CPU_Y = 3;
+static constexpr uint64_t X280_DDR_BASE = 0x4000'3000'0000ULL;
+
+// Source: L2CPU::BENCH_SCRATCH_OFFSET in A's X280 DRAM.  Destination: a 2 MiB
+// page of card B's first DRAM bank.  Both overwritten.
+static constexpr uint64_t DEFAULT_DST_ADDRESS = 0x1000'0000ULL;
+
+static constexpr size_t MAX_SIZE = 2ULL << 20;
+
+struct Options
+{
+    std::string path_a = "/dev/tenstorrent/0";
+    std::string path_b = "/dev/tenstorrent/1";
+    uint32_t pcie_x = PCIE_X;
+    uint32_t pcie_y = PCIE_Y;
+    uint64_t src_offset = L2CPU::BENCH_SCRATCH_OFFSET;
+    uint64_t dst_address = DEFAULT_DST_ADDRESS;
+    size_t trials = 10;
+    std::string initiator = "dmac"; // dmac, host
+};
+
+static void usage(const char* argv0)
+{
+    fmt::print("Usage: {} [options]\n", argv0);
+    fmt::print("  Card A to card B bandwidth: peer-to-peer through a mapped peer BAR, against\n");
+    fmt::print("  bouncing through host memory.  Source is X280 DRAM on A (L2CPU {},{}),\n", L2CPU_X, L2CPU_Y);
+    fmt::print("  destination is DRAM on B.  TT_DEVICE=emulated runs both as emulated cards,\n");
+    fmt::print("  bounce only: emulated cards don't pass outbound PCIe writes to their peer.\n");
+    fmt::print("  Reprograms the L2CPU's NOC TLBs and overwrites its DRAM: don't run it while\n");
+    fmt::print("  that L2CPU's X280s are running Linux.\n\n");
+    fmt::print("  --a PATH            card A (default /dev/tenstorrent/0)\n");
+    fmt::print("  --b PATH            card B (default /dev/tenstorrent/1)\n");
+    fmt::print("  --pcie X,Y          card A's PCIe core toward the host (default {},{})\n", PCIE_X, PCIE_Y);
+    fmt::print("  --src OFFSET        into A's X280 DRAM (default {:#x})\n", L2CPU::BENCH_SCRATCH_OFFSET);
+    fmt::print("  --dst ADDRESS       in B's first DRAM bank, 2 MiB-aligned (default {:#x})\n", DEFAULT_DST_ADDRESS);
+    fmt::print("  --trials N          timed repetitions per case (default 10)\n");
+    fmt::print("  --initiator NAME    who writes peer-to-peer: dmac (A's L2CPU DMAC, default), or\n");
+    fmt::print("                      host (host stores through A's PCIe core)\n");
+}
+
+static Options parse_options(int argc, char** argv)
+{
+    Options options;
+
+    const char* env = std::getenv("TT_DEVICE");
+    if (env && std::string(env) == BlackholePciDevice::EMULATED) {
+        options.path_a = options.path_b = env;
+    }
+
+    parse_command_line(argc, argv, {}, [&](const std::string& arg, const std::string& value) {
+        if (arg == "--a") {
+            options.path_a = value;
+        } else if (arg == "--b") {
+            options.path_b = value;
+        } else if (arg == "--pcie") {
+            return parse_xy(value, options.pcie_x, options.pcie_y);
+        } else if (arg == "--src") {
+            options.src_offset = std::stoull(value, nullptr, 0);
+        } else if (arg == "--dst") {
+            options.dst_address = std::stoull(value, nullptr, 0);
+        } else if (arg == "--trials") {
+            options.trials = std::max<size_t>(1, std::stoull(value));
+        } else if (arg == "--initiator") {
+            options.initiator = value;
+            return value == "dmac" || value == "host";
+        } else {
+            return false;
+        }
+        return true;
+    }, usage);
+
+    return options;
+}
+
+int main(int argc, char** argv)
+{
+    Options options = parse_options(argc, argv);
+
+    BlackholePciDevice a(options.path_a);
+    BlackholePciDevice b(options.path_b);
+
+    const NocXY dram = Blackhole::DRAM_LOCATIONS[0][0];
+    L2CPU l2cpu(a, L2CPU_X, L2CPU_Y);
+    PCIeCore pcie(a, options.pcie_x, options.pcie_y);
+
+    std::vector<uint8_t> pattern(MAX_SIZE);
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        pattern[i] = uint8_t(i * 13 + 5);
+    }
+    l2cpu.map_dram_2M_WC(options.src_offset)->write_block(0, pattern.data(), pattern.size());
+    sfence();
+
+    // B's DRAM, as A sees it: B's window -> bus address -> A's outbound entry.
+    auto b_window = b.map_tlb_2M_WC(dram.x, dram.y, options.dst_address);
+    const uint64_t bus_address = a.map_peer_window(b, *b_window);
+    auto outbound = pcie.map_outbound(OutboundTlbConfig::strict());
+    const uint64_t noc_address = outbound->get_noc_address() + bus_address;
+
+    // Emulated cards drop outbound PCIe writes instead of delivering them to
+    // the peer, so the peer path would only ever report MISMATCH.
+    const bool emulated = options.path_a == BlackholePciDevice::EMULATED ||
+                          options.path_b == BlackholePciDevice::EMULATED;
+
+    std::function<void(size_t)> peer_copy;
+    std::unique_ptr<L2CpuDma> dmac;
+    std::unique_ptr<L2CpuNocWindow> x280_window;
+    std::unique_ptr<TlbWindow> a_window;
+
+    if (emulated) {
+        fmt::print("peer     skipped: emulated cards don't route PCIe writes to each other\n");
+    } else if (options.initiator == "dmac") {
+        dmac = std::make_unique<L2CpuDma>(l2cpu);
+        x280_window = l2cpu.map_noc_tlb_128G(options.pcie_x, options.pcie_y, noc_address);
+        const uint64_t src = X280_DDR_BASE + options.src_offset;
+        const uint64_t dst = x280_window->get_x280_address();
+        peer_copy = [&, src, dst](size_t size) { dmac->wait(dmac->submit(dst, src, size)); };
+    } else {
+        a_window = a.map_tlb_4G(options.pcie_x, options.pcie_y, noc_address);
+        peer_copy = [&](size_t size) {
+            a_window->write_block(0, pattern.data(), size);
+            sfence();
+            a_window->read32(0); // returns once the writes ahead of it have landed
+        };
+    }
+
+    // What we do today: pull it up into host memory, push it down again.
+    std::vector<uint8_t> bounce(MAX_SIZE);
+    auto bounce_copy = [&](size_t size) {
+        a.read(L2CPU_X, L2CPU_Y, X280_DDR_BASE + options.src_offset, bounce.data(), size);
+        b.write(dram.x, dram.y, options.dst_address, bounce.data(), size);
+        b_window->read32(0);
+    };
+
+    fmt::print("{:<8} {:>8} {:>10} {:>8}  {}\n", "path", "bytes", "median_ns", "GiB/s", "check");
+
+    std::vector<uint8_t> check(MAX_SIZE);
+    for (size_t size : size_sweep(4096, MAX_SIZE, 4)) {
+        for (const char* path : {"peer", "bounce"}) {
+            if (!peer_copy && std::string(path) == "peer") {
+                continue;
+            }
+            b_window->write_block(0, std::vector<uint8_t>(size, 0).data(), size);
+
+            auto copy = std::string(path) == "peer" ? peer_copy : std::function<void(size_t)>(bounce_copy);
+            uint64_t ns = median_ns(options.trials, [&] { copy(size); });
+            double gib_per_sec = (size / double(1ULL << 30)) / (ns / 1e9);
+
+            b_window->read_block(0, check.data(), size);
+            bool ok = std::memcmp(check.data(), pattern.data(), size) == 0;
+            fmt::print("{:<8} {:>8} {:>10} {:>8.2f}  {}\n", path, size, ns, gib_per_sec, ok ? "ok" : "MISMATCH");
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,217 @@
+#include "blackhole_pcie.hpp"
+#include "l2cpu_core.hpp"
+#include "prefetch_tuner.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+
+using namespace tt;
+
+static constexpr uint32_t L2CPU_X = 8;
+static constexpr uint32_t L2CPU_Y = 3;
+
+// 1 MiB below x280-net's buffers.  Must match what the X280 program uses
+// (SLOT_ADDRESS in x280-prefetch/prefetch_worker.cpp).
+static constexpr uint64_t DEFAULT_SLOT = 0x4001'2fd0'0000ULL;
+
+// configure_prefetcher_recommended()
+static constexpr uint32_t BASE_CTRL0 = 0x15811;
+static constexpr uint32_t BASE_CTRL1 = 0x38c84e;
+
+struct Options
+{
+    uint32_t x = L2CPU_X;
+    uint32_t y = L2CPU_Y;
+    uint64_t slot = DEFAULT_SLOT;
+    std::vector<uint32_t> workloads;
+    uint32_t iterations = 1;
+    size_t repeats = 5;
+    uint64_t timeout_ms = 10'000;
+    bool quick = false;
+    bool apply = false;
+    std::string csv_path;
+};
+
+static void usage(const char* argv0)
+{
+    fmt::print("Usage: {} [options]\n", argv0);
+    fmt::print("  Sweeps the X280 L2 prefetcher settings while a cooperating program on the X280\n");
+    fmt::print("  runs workloads on request (see PrefetchTuneSlot), and reports the Pareto-best.\n\n");
+    fmt::print("  --l2cpu X,Y         L2CPU tile (default {},{})\n", L2CPU_X, L2CPU_Y);
+    fmt::print("  --slot ADDR         NOC address of the mailbox (default {:#x})\n", DEFAULT_SLOT);
+    fmt::print("  --workload N        workload ID to time; repeat for several (default 0)\n");
+    fmt::print("  --iterations N      passed to the X280 program (default 1)\n");
+    fmt::print("  --repeats N         timed runs per candidate and workload (default 5)\n");
+    fmt::print("  --timeout-ms N      per run (default 10000)\n");
+    fmt::print("  --quick             small sweep, enables left as in the base settings\n");
+    fmt::print("  --csv FILE          write every candidate's results\n");
+    fmt::print("  --apply             leave the best settings programmed instead of restoring\n");
+}
+
+static Options parse_options(int argc, char** argv)
+{
+    Options options;
+
+    const std::vector<std::string> flags = {"--quick", "--apply"};
+    parse_command_line(argc, argv, flags, [&](const std::string& arg, const std::string& value) {
+        if (arg == "--quick") {
+            options.quick = true;
+        } else if (arg == "--apply") {
+            options.apply = true;
+        } else if (arg == "--l2cpu") {
+            return parse_xy(value, options.x, options.y);
+        } else if (arg == "--slot") {
+            options.slot = std::stoull(value, nullptr, 0);
+        } else if (arg == "--workload") {
+            options.workloads.push_back(std::stoul(value, nullptr, 0));
+        } else if (arg == "--iterations") {
+            options.iterations = std::stoul(value);
+        } else if (arg == "--repeats") {
+            options.repeats = std::max<size_t>(1, std::stoull(value));
+        } else if (arg == "--timeout-ms") {
+            options.timeout_ms = std::stoull(value);
+        } else if (arg == "--csv") {
+            options.csv_path = value;
+        } else {
+            return false;
+        }
+        return true;
+    }, usage);
+
+    if (options.workloads.empty()) {
+        options.workloads.push_back(0);
+    }
+    return options;
+}
+
+static std::string describe(const PrefetcherSetting& s)
+{
+    return fmt::format("init {:>2} max {:>2} lin2exp {:>2} window {:>2} ld {}{} st {}{}", s.initial_dist,
+                       s.max_allowed_dist, s.lin_to_exp_thrd, s.window, s.scalar_load ? 'S' : '-',
+                       s.vector_load ? 'V' : '-', s.scalar_store ? 'S' : '-', s.vector_store ? 'V' : '-');
+}
+
+static void print_result(const PrefetchResult& result)
+{
+    fmt::print("{:#07x} {:#08x}  {}", result.ctrl0, result.ctrl1, describe(result.setting));
+    for (auto cycles : result.cycles) {
+        fmt::print("  {:>12}", cycles);
+    }
+    fmt::print("\n");
+}
+
+static void write_csv(const std::string& path, const std::vector<PrefetchResult>& results,
+                      const std::vector<uint32_t>& workloads, const std::vector<size_t>& front)
+{
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+
+    fmt::print(file, "ctrl0,ctrl1,initial_dist,max_allowed_dist,lin_to_exp_thrd,window,"
+                     "scalar_load,vector_load,scalar_store,vector_store,pareto");
+    for (auto workload : workloads) {
+        fmt::print(file, ",cycles_w{}", workload);
+    }
+    fmt::print(file, "\n");
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        const auto& s = r.setting;
+        bool pareto = std::find(front.begin(), front.end(), i) != front.end();
+        fmt::print(file, "{:#x},{:#x},{},{},{},{},{},{},{},{},{}", r.ctrl0, r.ctrl1, s.initial_dist,
+                   s.max_allowed_dist, s.lin_to_exp_thrd, s.window, int(s.scalar_load), int(s.vector_load),
+                   int(s.scalar_store), int(s.vector_store), int(pareto));
+        for (auto cycles : r.cycles) {
+            fmt::print(file, ",{}", cycles);
+        }
+        fmt::print(file, "\n");
+    }
+
+    std::fclose(file);
+}
+
+// The Pareto entry that is, summed over workloads, the smallest fraction
+// slower than the best seen for each workload.
+static size_t pick_best(const std::vector<PrefetchResult>& results, const std::vector<size_t>& front)
+{
+    std::vector<uint64_t> fastest(results[0].cycles.size(), std::numeric_limits<uint64_t>::max());
+    for (const auto& result : results) {
+        for (size_t w = 0; w < fastest.size(); ++w) {
+            fastest[w] = std::min(fastest[w], result.cycles[w]);
+        }
+    }
+
+    size_t best = front[0];
+    double best_score = std::numeric_limits<double>::max();
+    for (auto i : front) {
+        double score = 0;
+        for (size_t w = 0; w < fastest.size(); ++w) {
+            score += fastest[w] ? double(results[i].cycles[w]) / fastest[w] : 0;
+        }
+        if (score < best_score) {
+            best_score = score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    Options options = parse_options(argc, argv);
+
+    BlackholePciDevice device(device_path());
+    L2CPU l2cpu(device, options.x, options.y);
+    PrefetchTuner tuner(device, l2cpu, options.slot);
+    tuner.set_iterations(options.iterations);
+    tuner.set_repeats(options.repeats);
+    tuner.set_timeout(std::chrono::milliseconds(options.timeout_ms));
+
+    PrefetchSweep sweep;
+    if (options.quick) {
+        sweep.initial_dist = {2, 8};
+        sweep.max_allowed_dist = {16, 63};
+        sweep.lin_to_exp_thrd = {5};
+        sweep.window = {16};
+        sweep.sweep_enables = false;
+    }
+
+    fmt::print("{:>7} {:>8}  {:<52}", "ctrl0", "ctrl1", "setting");
+    for (auto workload : options.workloads) {
+        fmt::print("  {:>12}", fmt::format("w{} cycles", workload));
+    }
+    fmt::print("\n");
+
+    auto progress = [](const PrefetchResult& result, size_t, size_t) { print_result(result); };
+    auto results = tuner.tune(sweep, BASE_CTRL0, BASE_CTRL1, options.workloads, progress);
+    auto front = PrefetchTuner::pareto_front(results);
+
+    fmt::print("\nPareto-best ({} of {}):\n", front.size(), results.size());
+    for (auto i : front) {
+        print_result(results[i]);
+    }
+
+    const auto& best = results[pick_best(results, front)];
+    fmt::print("\nSuggested: configure_prefetcher({:#x}, {:#x})\n", best.ctrl0, best.ctrl1);
+
+    if (options.apply) {
+        tuner.keep(best.ctrl0, best.ctrl1);
+        fmt::print("Leaving it programmed.\n");
+    }
+
+    if (!options.csv_path.empty()) {
+        write_csv(options.csv_path, results, options.workloads, front);
+        fmt::print("Wrote {}\n", options.csv_path);
+    }
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include "async_dma_pin.hpp"
+
+#include "blackhole_pcie.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace tt {
+
+AsyncDmaPin::AsyncDmaPin(BlackholePciDevice& device, const void* buffer, size_t size, size_t chunk_size)
+    : device(device)
+    , buffer(static_cast<const uint8_t*>(buffer))
+    , total_size(size)
+    , chunk_size((std::max<size_t>(chunk_size, 1) + 0xFFF) & ~size_t(0xFFF))
+{
+    // Not started in the initializer list: every member has to be ready first.
+    worker = std::thread(&AsyncDmaPin::run, this);
+}
+
+AsyncDmaPin::~AsyncDmaPin()
+{
+    {
+        std::scoped_lock lock(mutex);
+        stop = true;
+    }
+    worker.join();
+
+    for (const auto& chunk : pinned) {
+        try {
+            device.unmap_for_dma(chunk.iova);
+        } catch (const std::exception& e) {
+            LOG_ERROR("AsyncDmaPin: unmap_for_dma failed: {}", e.what());
+        }
+    }
+
+    // Matters if the device retains idle pins: the buffer is probably about
+    // to be freed, and a cached chunk would outlive it.
+    if (!pinned.empty()) {
+        try {
+            device.invalidate_dma_cache(buffer, pinned_size);
+        } catch (const std::exception& e) {
+            LOG_ERROR("AsyncDmaPin: invalidate_dma_cache failed: {}", e.what());
+        }
+    }
+}
+
+size_t AsyncDmaPin::pinned_bytes()
+{
+    std::scoped_lock lock(mutex);
+    return pinned_size;
+}
+
+bool AsyncDmaPin::done()
+{
+    std::scoped_lock lock(mutex);
+    return finished;
+}
+
+size_t AsyncDmaPin::wait_for(size_t bytes, std::chrono::milliseconds timeout)
+{
+    bytes = std::min(bytes, total_size);
+
+    std::unique_lock lock(mutex);
+    const bool ready = progress.wait_for(lock, timeout, [&] { return pinned_size >= bytes || finished; });
+
+    if (pinned_size >= bytes) {
+        return pinned_size;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if (!ready) {
+        throw std::runtime_error("Timed out waiting for DMA pin");
+    }
+    throw std::runtime_error("DMA pin stopped early");
+}
+
+uint64_t AsyncDmaPin::iova(size_t offset)
+{
+    std::scoped_lock lock(mutex);
+    const Chunk& chunk = chunk_at(offset);
+    return chunk.iova + (offset - chunk.offset);
+}
+
+size_t AsyncDmaPin::contiguous(size_t offset)
+{
+    std::scoped_lock lock(mutex);
+    const Chunk& chunk = chunk_at(offset);
+    size_t length = chunk.offset + chunk.size - offset;
+    uint64_t next_iova = chunk.iova + chunk.size;
+
+    // The IOMMU allocator often hands out consecutive ranges; take advantage.
+    for (size_t i = (chunk.offset / chunk_size) + 1; i < pinned.size() && pinned[i].iova == next_iova; ++i) {
+        length += pinned[i].size;
+        next_iova += pinned[i].size;
+    }
+
+    return length;
+}
+
+std::vector<AsyncDmaPin::Chunk> AsyncDmaPin::chunks()
+{
+    std::scoped_lock lock(mutex);
+    return pinned;
+}
+
+const AsyncDmaPin::Chunk& AsyncDmaPin::chunk_at(size_t offset)
+{
+    if (offset >= pinned_size) {
+        throw std::out_of_range("Offset is not pinned yet");
+    }
+    return pinned[offset / chunk_size];
+}
+
+void AsyncDmaPin::run()
+{
+    try {
+        for (size_t offset = 0; offset < total_size; offset += chunk_size) {
+            {
+                std::scoped_lock lock(mutex);
+                if (stop) {
+                    break;
+                }
+            }
+
+            const size_t size = std::min(chunk_size, total_size - offset);
+            const uint64_t iova = device.map_for_dma(buffer + offset, size);
+
+            std::scoped_lock lock(mutex);
+            pinned.push_back(Chunk{offset, size, iova});
+            pinned_size = offset + size;
+            progress.notify_all();
+        }
+    } catch (...) {
+        std::scoped_lock lock(mutex);
+        error = std::current_exception();
+    }
+
+    std::scoped_lock lock(mutex);
+    finished = true;
+    progress.notify_all();
+}
+
+} // namespace tt
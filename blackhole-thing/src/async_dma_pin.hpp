@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tt {
+
+class BlackholePciDevice;
+
+/**
+ * @brief Pins a large host buffer in chunks on a background thread.
+ *
+ * map_for_dma on 48 GiB is one ioctl that takes seconds.  This pins the
+ * buffer front to back, one chunk per ioctl, and publishes how much of it is
+ * device-visible so far.  Transfers can use the pinned prefix while the rest
+ * is still being pinned.
+ *
+ * Each chunk is its own pin with its own IOVA; chunks are not guaranteed to be
+ * contiguous in IOVA space.  Use iova() per offset and contiguous() to find
+ * how far a DMA from that offset can run.
+ *
+ * Chunks go through the device's registration cache like any other
+ * map_for_dma.  When this object is destroyed they are unmapped and their
+ * range is invalidated in the cache; errors are logged, not thrown.
+ * Destroying it before pinning finishes stops the background thread after
+ * the chunk it is working on.
+ */
+class AsyncDmaPin
+{
+public:
+    struct Chunk
+    {
+        size_t offset; // from the start of the buffer
+        size_t size;
+        uint64_t iova;
+    };
+
+    /**
+     * @param buffer constraint: must be page-aligned
+     * @param size constraint: must be a multiple of the page size
+     * @param chunk_size bytes per pin; rounded up to 4 KiB.  Make it a
+     * multiple of the buffer's page size if it uses huge pages.
+     */
+    AsyncDmaPin(BlackholePciDevice& device, const void* buffer, size_t size, size_t chunk_size = 1ULL << 30);
+    ~AsyncDmaPin();
+
+    AsyncDmaPin(const AsyncDmaPin&) = delete;
+    AsyncDmaPin& operator=(const AsyncDmaPin&) = delete;
+
+    size_t size() const { return total_size; }
+
+    /**
+     * @brief Length of the prefix that is pinned and device-visible.
+     */
+    size_t pinned_bytes();
+
+    bool done();
+
+    /**
+     * @brief Block until at least `bytes` of the buffer are pinned.
+     *
+     * @return the pinned prefix length, which may be more than asked for
+     * @throws whatever the background pin threw, or std::runtime_error on
+     * timeout
+     */
+    size_t wait_for(size_t bytes, std::chrono::milliseconds timeout = std::chrono::minutes(5));
+
+    /**
+     * @brief Block until the whole buffer is pinned.
+     */
+    void wait() { wait_for(total_size); }
+
+    /**
+     * @brief IOVA of a byte in the pinned prefix.
+     *
+     * @throws std::out_of_range if offset is not pinned yet
+     */
+    uint64_t iova(size_t offset);
+
+    /**
+     * @brief Bytes starting at offset that are contiguous in IOVA space.
+     *
+     * @throws std::out_of_range if offset is not pinned yet
+     */
+    size_t contiguous(size_t offset);
+
+    /**
+     * @brief Snapshot of the chunks pinned so far, in buffer order.
+     */
+    std::vector<Chunk> chunks();
+
+private:
+    void run();
+    const Chunk& chunk_at(size_t offset); // caller holds the mutex
+
+    BlackholePciDevice& device;
+    const uint8_t* const buffer;
+    const size_t total_size;
+    const size_t chunk_size;
+
+    std::mutex mutex;
+    std::condition_variable progress;
+    std::vector<Chunk> pinned;
+    size_t pinned_size = 0;
+    bool stop = false;
+    bool finished = false;
+    std::exception_ptr error;
+
+    std::thread worker;
+};
+
+} // namespace tt
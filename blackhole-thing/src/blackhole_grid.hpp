@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace tt {
+
+struct NocXY
+{
+    uint32_t x;
+    uint32_t y;
+};
+
+/**
+ * @brief Tensix locations: two 7x10 rectangles, (1, 2)-(7, 11) and
+ * (10, 2)-(16, 11), row by row.
+ */
+template <size_t N> constexpr std::array<NocXY, N> make_tensix_locations()
+{
+    std::array<NocXY, N> locations{};
+    for (uint32_t i = 0; i < N; ++i) {
+        locations[i].x = ((i % 14) < 7) ? (1 + (i % 7)) : (10 + (i % 7));
+        locations[i].y = 2 + (i / 14);
+    }
+    return locations;
+}
+
+/**
+ * @brief Where things are on the Blackhole NOC (NOC0 coordinates).
+ *
+ * Same caveat as everywhere else: these are untranslated coordinates.
+ */
+struct Blackhole
+{
+    // One row per DRAM channel; each channel has three NOC endpoints.  They
+    // all reach the same memory, but spreading traffic across endpoints (and
+    // especially across channels) spreads it across the NOC.
+    static constexpr size_t NUM_DRAM_CHANNELS = 8;
+    static constexpr size_t NUM_DRAM_ENDPOINTS_PER_CHANNEL = 3;
+    static constexpr std::array<std::array<NocXY, NUM_DRAM_ENDPOINTS_PER_CHANNEL>, NUM_DRAM_CHANNELS>
+        DRAM_LOCATIONS = {{
+            {{{0, 0}, {0, 1}, {0, 11}}},
+            {{{0, 2}, {0, 10}, {0, 3}}},
+            {{{0, 9}, {0, 4}, {0, 8}}},
+            {{{0, 5}, {0, 7}, {0, 6}}},
+            {{{9, 0}, {9, 1}, {9, 11}}},
+            {{{9, 2}, {9, 10}, {9, 3}}},
+            {{{9, 9}, {9, 4}, {9, 8}}},
+            {{{9, 5}, {9, 7}, {9, 6}}},
+        }};
+
+    // Channels whose memory backs an X280 (see memory_for_x280.cpp): 5 holds
+    // (9,3) -> L2CPU (8,3), 6 holds (9,8) -> L2CPU (8,9), and 7 holds (9,6) ->
+    // L2CPUs (8,5) and (8,7).  Anything that scribbles over DRAM should stay
+    // away from these while an X280 might be running.
+    static constexpr std::array<bool, NUM_DRAM_CHANNELS> DRAM_CHANNEL_BACKS_X280 = {
+        false, false, false, false, false, true, true, true,
+    };
+
+    static constexpr size_t GRID_WIDTH = 17;
+    static constexpr size_t GRID_HEIGHT = 12;
+
+    // (8,4), (8,6), (8,8) and (8,10) are something else; touching the wrong
+    // one kills the card.  See memory_for_x280.cpp.
+    static constexpr size_t NUM_L2CPUS = 4;
+    static constexpr std::array<NocXY, NUM_L2CPUS> L2CPU_LOCATIONS = {{{8, 3}, {8, 5}, {8, 7}, {8, 9}}};
+
+    static constexpr size_t NUM_PCIE_CORES = 2;
+    static constexpr std::array<NocXY, NUM_PCIE_CORES> PCIE_LOCATIONS = {{{2, 0}, {11, 0}}};
+
+    static constexpr size_t NUM_TENSIXES = 140;
+    static const std::array<NocXY, NUM_TENSIXES> TENSIX_LOCATIONS;
+};
+
+inline constexpr std::array<NocXY, Blackhole::NUM_TENSIXES> Blackhole::TENSIX_LOCATIONS =
+    make_tensix_locations<Blackhole::NUM_TENSIXES>();
+
+} // namespace tt
@@ -1,17 +1,21 @@
 #include "blackhole_pcie.hpp"
 
 #include "atomic.hpp"
+#include "emulated_device.hpp"
 #include "ioctl.h"
 #include "logger.hpp"
+#include "mmio_copy.hpp"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
 #include <functional>
 #include <iostream>
-#include <numeric>
 #include <stdexcept>
 
 #define IOCTL(fd, request, arg)                                                                                        \
@@ -187,6 +191,34 @@ static uint8_t* map_bar4(int fd, size_t size)
     return static_cast<uint8_t*>(bar4);
 }
 
+static uint64_t pin_pages(int fd, uint64_t va, size_t size)
+{
+    tenstorrent_pin_pages pin{};
+    pin.in.output_size_bytes = sizeof(pin.out);
+    pin.in.virtual_address = va;
+    pin.in.size = size;
+    // pin.in.flags = TENSTORRENT_PIN_PAGES_INTO_IOMMU;
+
+    // If this is failing on you, check that the buffer is page-aligned and
+    // that the size is a multiple of the page size.  Also that IOMMU is on.
+    IOCTL(fd, TENSTORRENT_IOCTL_PIN_PAGES, &pin);
+
+    return pin.out.physical_address;
+}
+
+static void unpin_pages(int fd, uint64_t va, size_t size)
+{
+    tenstorrent_unpin_pages unpin{};
+    unpin.in.virtual_address = va;
+    unpin.in.size = size;
+
+    // Older KMDs don't have UNPIN_PAGES; they unpin when the fd is closed, and
+    // there is nothing better to do than let them.
+    if (ioctl(fd, TENSTORRENT_IOCTL_UNPIN_PAGES, &unpin) < 0 && errno != ENOTTY) {
+        throw std::runtime_error("ioctl failed");
+    }
+}
+
 class BlackholeTLB : public TlbWindow
 {
     std::function<void()> on_destruct;
@@ -212,8 +244,7 @@ public:
             throw std::out_of_range("Out of bounds access");
         }
 
-        // TODO: is this safe?  What about alignment?
-        std::memcpy(base + address, buffer, size);
+        mmio_write(base + address, buffer, size);
     }
 
     virtual void read_block(uint64_t address, void* buffer, size_t size) override
@@ -222,147 +253,548 @@ public:
             throw std::out_of_range("Out of bounds access");
         }
 
-        // TODO: is this safe?  What about alignment?
-        std::memcpy(buffer, base + address, size);
+        mmio_read(buffer, base + address, size);
     }
 };
 
+// Hardware and emulation have the same BAR layout.
+static constexpr size_t BAR0_SIZE = 1ULL << 29; // 512 MiB
+static constexpr size_t BAR2_SIZE = 1ULL << 20; //   1 MiB
+static constexpr size_t BAR4_SIZE = 1ULL << 35; //  32 GiB
+
+static std::unique_ptr<EmulatedDevice> make_emulation(const std::string& path)
+{
+    if (path != BlackholePciDevice::EMULATED) {
+        return nullptr;
+    }
+    return std::make_unique<EmulatedDevice>(BAR0_SIZE, BAR2_SIZE, BAR4_SIZE);
+}
+
 BlackholePciDevice::BlackholePciDevice(const std::string& path)
-    : fd(open(path.c_str(), O_RDWR | O_CLOEXEC))
-    , info(get_device_info(fd))
-    , bar0_size(1ULL << 29) // 512 MiB
-    , bar2_size(1ULL << 20) //   1 MiB
-    , bar4_size(1ULL << 35) //  32 GiB
-    , bar0(map_bar0(fd, bar0_size))
-    , bar2(map_bar2(fd, bar2_size))
-    , bar4(map_bar4(fd, bar4_size))
-    , free_tlb_indices_2M_WC(BH_NUM_2M_WC_TLBS, 0)
-    , free_tlb_indices_2M_UC(BH_NUM_2M_UC_TLBS, 0)
-    , free_tlb_indices_4G(BH_NUM_4G_TLBS, 0)
-{
-    std::iota(free_tlb_indices_2M_WC.begin(), free_tlb_indices_2M_WC.end(), BH_2M_TLB_WC_START);
-    std::iota(free_tlb_indices_2M_UC.begin(), free_tlb_indices_2M_UC.end(), BH_2M_TLB_UC_START);
-    std::iota(free_tlb_indices_4G.begin(), free_tlb_indices_4G.end(), BH_4G_TLB_START);
-    std::reverse(free_tlb_indices_2M_WC.begin(), free_tlb_indices_2M_WC.end()); // HACK
+    : emulation(make_emulation(path))
+    , fd(emulation ? -1 : open(path.c_str(), O_RDWR | O_CLOEXEC))
+    , info(emulation ? emulation->get_info() : get_device_info(fd))
+    , bar0_size(BAR0_SIZE)
+    , bar2_size(BAR2_SIZE)
+    , bar4_size(BAR4_SIZE)
+    , bar0(emulation ? emulation->get_bar0() : map_bar0(fd, bar0_size))
+    , bar2(emulation ? emulation->get_bar2() : map_bar2(fd, bar2_size))
+    , bar4(emulation ? emulation->get_bar4() : map_bar4(fd, bar4_size))
+    , free_tlb_indices_2M_WC(BH_2M_TLB_WC_START, BH_NUM_2M_WC_TLBS)
+    , free_tlb_indices_2M_UC(BH_2M_TLB_UC_START, BH_NUM_2M_UC_TLBS)
+    , free_tlb_indices_4G(BH_4G_TLB_START, BH_NUM_4G_TLBS)
+    , dma_cache(
+          [this](uint64_t va, size_t size) {
+              return emulation ? emulation->pin_pages(va, size) : pin_pages(fd, va, size);
+          },
+          [this](uint64_t va, size_t size) {
+              if (emulation) {
+                  emulation->unpin_pages(va, size);
+              } else {
+                  unpin_pages(fd, va, size);
+              }
+          })
+{
 }
 
 BlackholePciDevice::~BlackholePciDevice()
 {
-    munmap(bar0, bar0_size);
-    munmap(bar4, bar4_size);
-    close(fd);
+    for (const auto& buffer : driver_dma_buffers) {
+        if (buffer.memory) {
+            munmap(buffer.memory, buffer.size);
+        }
+    }
+
+    // The emulation owns its BARs.
+    if (!emulation) {
+        munmap(bar0, bar0_size);
+        munmap(bar4, bar4_size);
+        close(fd);
+    }
 }
 
-std::unique_ptr<TlbWindow> BlackholePciDevice::map_tlb_2M_WC(uint32_t x, uint32_t y, uint64_t address)
+// Tlb2M and Tlb4G share everything but the width of the address field.
+template <class T> static T make_tlb_config(uint32_t x, uint32_t y, uint64_t address, const TlbOptions& options)
 {
-    std::scoped_lock lock(tlb_mutex);
-
-    if (free_tlb_indices_2M_WC.empty()) {
-        throw std::runtime_error("No free 2MiB WC TLB entries available");
+    T tlb_config{};
+    tlb_config.address = address;
+    tlb_config.x_end = x;
+    tlb_config.y_end = y;
+    tlb_config.noc = options.noc;
+    tlb_config.ordering = static_cast<uint64_t>(options.ordering);
+    tlb_config.linked = options.linked ? 1 : 0;
+    tlb_config.use_static_vc = options.use_static_vc ? 1 : 0;
+    tlb_config.static_vc = options.static_vc;
+
+    if (options.multicast) {
+        if (options.noc == 0 && (options.x_start > x || options.y_start > y)) {
+            throw std::invalid_argument("Multicast start corner is beyond end corner");
+        }
+        tlb_config.multicast = 1;
+        tlb_config.x_start = options.x_start;
+        tlb_config.y_start = options.y_start;
     }
 
-    const size_t tlb_index = free_tlb_indices_2M_WC.back();
+    return tlb_config;
+}
+
+std::unique_ptr<TlbWindow> BlackholePciDevice::map_tlb_2M_WC(uint32_t x, uint32_t y, uint64_t address,
+                                                             const TlbOptions& options)
+{
+    return map_tlb_2M(x, y, address, true, options);
+}
+
+std::unique_ptr<TlbWindow> BlackholePciDevice::map_tlb_2M_UC(uint32_t x, uint32_t y, uint64_t address,
+                                                             const TlbOptions& options)
+{
+    return map_tlb_2M(x, y, address, false, options);
+}
+
+std::unique_ptr<TlbWindow> BlackholePciDevice::map_tlb_2M(uint32_t x, uint32_t y, uint64_t address, bool wc,
+                                                          const TlbOptions& options)
+{
+    // Validate before taking an index so a bad request doesn't leak one.
+    const auto tlb_config = make_tlb_config<pcie::Tlb2M>(x, y, address >> 21, options);
+
+    auto& free_tlb_indices = wc ? free_tlb_indices_2M_WC : free_tlb_indices_2M_UC;
+    const size_t tlb_index = allocate_tlb_index_2M(wc);
+
     const size_t tlb_size = 1 << 21;
     const size_t tlb_mask = tlb_size - 1;
     const uint64_t local_offset = address & tlb_mask;
     const size_t apparent_size = tlb_size - local_offset;
 
-    pcie::Tlb2M tlb_config{};
-    tlb_config.address = address >> 21;
-    tlb_config.x_end = x;
-    tlb_config.y_end = y;
-
     write_tlb_config_2M(tlb_index, tlb_config);
 
     void* memory = bar0 + (tlb_size * tlb_index) + local_offset;
-    auto release = [this, tlb_index]() {
-        std::scoped_lock lock(tlb_mutex);
-        free_tlb_indices_2M_WC.push_back(tlb_index);
-    };
-
-    free_tlb_indices_2M_WC.pop_back();
+    auto release = [&free_tlb_indices, tlb_index]() { free_tlb_indices.release(tlb_index); };
 
     return std::make_unique<BlackholeTLB>(memory, apparent_size, release);
 }
 
-// This is pasta, for WC vs UC.
-std::unique_ptr<TlbWindow> BlackholePciDevice::map_tlb_2M_UC(uint32_t x, uint32_t y, uint64_t address)
+std::vector<std::unique_ptr<TlbWindow>> BlackholePciDevice::map_tlbs_2M_WC(const std::vector<TlbTarget>& targets)
+{
+    return map_tlbs_2M(targets, true);
+}
+
+std::vector<std::unique_ptr<TlbWindow>> BlackholePciDevice::map_tlbs_2M_UC(const std::vector<TlbTarget>& targets)
 {
-    std::scoped_lock lock(tlb_mutex);
+    return map_tlbs_2M(targets, false);
+}
 
-    if (free_tlb_indices_2M_UC.empty()) {
-        throw std::runtime_error("No free 2MiB UC TLB entries available");
+std::vector<std::unique_ptr<TlbWindow>> BlackholePciDevice::map_tlbs_2M(const std::vector<TlbTarget>& targets, bool wc)
+{
+    const size_t tlb_size = 1 << 21;
+    const size_t tlb_mask = tlb_size - 1;
+    auto& free_tlb_indices = wc ? free_tlb_indices_2M_WC : free_tlb_indices_2M_UC;
+
+    std::vector<pcie::Tlb2M> tlb_configs;
+    for (const auto& target : targets) {
+        tlb_configs.push_back(make_tlb_config<pcie::Tlb2M>(target.x, target.y, target.address >> 21, target.options));
     }
 
-    const size_t tlb_index = free_tlb_indices_2M_UC.back();
+    std::vector<size_t> tlb_indices;
+    try {
+        for (size_t i = 0; i < targets.size(); ++i) {
+            tlb_indices.push_back(allocate_tlb_index_2M(wc));
+        }
+    } catch (...) {
+        for (auto tlb_index : tlb_indices) {
+            free_tlb_indices.release(tlb_index);
+        }
+        throw;
+    }
+
+    // Same as write_tlb_config_2M, minus all but the outermost fences.
+    mfence();
+    for (size_t i = 0; i < targets.size(); ++i) {
+        CHECK(tlb_indices[i] >= BH_2M_TLB_START);
+        CHECK(tlb_indices[i] <= BH_2M_TLB_END);
+
+        volatile uint32_t* dst = tlb_config_registers(tlb_indices[i]);
+        dst[0] = tlb_configs[i].data[0];
+        dst[1] = tlb_configs[i].data[1];
+        dst[2] = tlb_configs[i].data[2];
+    }
+    mfence();
+
+    for (size_t i = 0; emulation && i < targets.size(); ++i) {
+        emulate_tlb_config_2M(tlb_indices[i], tlb_configs[i]);
+    }
+
+    std::vector<std::unique_ptr<TlbWindow>> windows;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        const uint64_t local_offset = targets[i].address & tlb_mask;
+        const size_t apparent_size = tlb_size - local_offset;
+        void* memory = bar0 + (tlb_size * tlb_indices[i]) + local_offset;
+        auto release = [&free_tlb_indices, tlb_index = tlb_indices[i]]() { free_tlb_indices.release(tlb_index); };
+
+        windows.push_back(std::make_unique<BlackholeTLB>(memory, apparent_size, release));
+    }
+
+    return windows;
+}
+
+size_t BlackholePciDevice::allocate_tlb_index_2M(bool wc)
+{
+    auto& free_tlb_indices = wc ? free_tlb_indices_2M_WC : free_tlb_indices_2M_UC;
+    auto tlb_index = free_tlb_indices.allocate();
+
+    // The pool is empty, but the cache might be sitting on an idle window.
+    if (!tlb_index) {
+        std::scoped_lock lock(tlb_cache_mutex);
+        tlb_index = evict_cached_tlb_index_2M(wc);
+        if (tlb_index) {
+            tlb_cache_stats.evictions++;
+        }
+    }
+
+    if (!tlb_index) {
+        throw std::runtime_error(wc ? "No free 2MiB WC TLB entries available"
+                                    : "No free 2MiB UC TLB entries available");
+    }
+
+    return *tlb_index;
+}
+
+void BlackholePciDevice::write(uint32_t x, uint32_t y, uint64_t address, const void* src, size_t size)
+{
+    // stream() does not write through the host pointer when copying to device.
+    stream(x, y, address, static_cast<uint8_t*>(const_cast<void*>(src)), size, true);
+}
+
+void BlackholePciDevice::read(uint32_t x, uint32_t y, uint64_t address, void* dst, size_t size)
+{
+    stream(x, y, address, static_cast<uint8_t*>(dst), size, false);
+}
+
+void BlackholePciDevice::stream(uint32_t x, uint32_t y, uint64_t address, uint8_t* host, size_t size,
+                                bool to_device)
+{
+    static constexpr size_t NUM_WINDOWS = 2;
+    const size_t tlb_size = 1 << 21;
+    const size_t tlb_mask = tlb_size - 1;
+
+    if (size == 0) {
+        return;
+    }
+
+    // Hold the windows for the whole transfer.  Allocating the second one can
+    // throw, so the first must be given back on the way out.
+    struct Windows
+    {
+        TlbIndexPool& pool;
+        std::array<std::optional<size_t>, NUM_WINDOWS> indices{};
+        ~Windows()
+        {
+            for (auto& index : indices) {
+                if (index) {
+                    pool.release(*index);
+                }
+            }
+        }
+    } windows{free_tlb_indices_2M_WC};
+
+    for (auto& index : windows.indices) {
+        index = allocate_tlb_index_2M(true);
+    }
+
+    auto program = [&](size_t slot, uint64_t chunk_address) {
+        const auto tlb_config = make_tlb_config<pcie::Tlb2M>(x, y, chunk_address >> 21, TlbOptions{});
+        write_tlb_config_2M(*windows.indices[slot], tlb_config);
+    };
+
+    size_t slot = 0;
+    program(slot, address);
+
+    while (size > 0) {
+        const uint64_t local_offset = address & tlb_mask;
+        const size_t chunk_size = std::min(size, tlb_size - local_offset);
+        const size_t next_slot = (slot + 1) % NUM_WINDOWS;
+
+        // Point the other window at the next chunk before touching this one.
+        // The fence in write_tlb_config_2M drains any WC stores still headed
+        // for that window's previous target.
+        if (size > chunk_size) {
+            program(next_slot, address + chunk_size);
+        }
+
+        uint8_t* mmio = bar0 + (tlb_size * *windows.indices[slot]) + local_offset;
+        if (to_device) {
+            mmio_write(mmio, host, chunk_size);
+        } else {
+            mmio_read(host, mmio, chunk_size);
+        }
+
+        address += chunk_size;
+        host += chunk_size;
+        size -= chunk_size;
+        slot = next_slot;
+    }
+}
+
+std::unique_ptr<TlbWindow> BlackholePciDevice::map_tlb_2M_WC_cached(uint32_t x, uint32_t y, uint64_t address)
+{
+    return map_tlb_2M_cached(x, y, address, true);
+}
+
+std::unique_ptr<TlbWindow> BlackholePciDevice::map_tlb_2M_UC_cached(uint32_t x, uint32_t y, uint64_t address)
+{
+    return map_tlb_2M_cached(x, y, address, false);
+}
+
+// 43 bits of 2 MiB page number, 6 bits each of x and y, 1 bit for WC vs UC.
+static uint64_t tlb_cache_key(uint32_t x, uint32_t y, uint64_t address, bool wc)
+{
+    const uint64_t page = (address >> 21) & ((1ULL << 43) - 1);
+    return page | (uint64_t(x & 0x3F) << 43) | (uint64_t(y & 0x3F) << 49) | (uint64_t(wc) << 55);
+}
+
+static bool tlb_cache_key_is_wc(uint64_t key)
+{
+    return (key >> 55) & 1;
+}
+
+std::unique_ptr<TlbWindow> BlackholePciDevice::map_tlb_2M_cached(uint32_t x, uint32_t y, uint64_t address, bool wc)
+{
+    std::scoped_lock lock(tlb_cache_mutex);
+
     const size_t tlb_size = 1 << 21;
     const size_t tlb_mask = tlb_size - 1;
     const uint64_t local_offset = address & tlb_mask;
     const size_t apparent_size = tlb_size - local_offset;
+    const uint64_t key = tlb_cache_key(x, y, address, wc);
+
+    auto lookup = tlb_cache_lookup.find(key);
+    if (lookup != tlb_cache_lookup.end()) {
+        tlb_cache.splice(tlb_cache.begin(), tlb_cache, lookup->second);
+        tlb_cache_stats.hits++;
+    } else {
+        bool reprogram = false;
+        auto tlb_index = (wc ? free_tlb_indices_2M_WC : free_tlb_indices_2M_UC).allocate();
+
+        if (!tlb_index) {
+            tlb_index = evict_cached_tlb_index_2M(wc);
+            reprogram = true;
+        }
 
-    pcie::Tlb2M tlb_config{};
-    tlb_config.address = address >> 21;
-    tlb_config.x_end = x;
-    tlb_config.y_end = y;
+        if (!tlb_index) {
+            throw std::runtime_error(wc ? "No free or idle 2MiB WC TLB entries available"
+                                        : "No free or idle 2MiB UC TLB entries available");
+        }
 
-    write_tlb_config_2M(tlb_index, tlb_config);
+        const auto tlb_config = make_tlb_config<pcie::Tlb2M>(x, y, address >> 21, TlbOptions{});
+        write_tlb_config_2M(*tlb_index, tlb_config);
 
-    void* memory = bar0 + (tlb_size * tlb_index) + local_offset;
-    auto release = [this, tlb_index]() {
-        std::scoped_lock lock(tlb_mutex);
-        free_tlb_indices_2M_UC.push_back(tlb_index);
-    };
+        tlb_cache.push_front(CachedTlb{key, *tlb_index, 0});
+        tlb_cache_lookup[key] = tlb_cache.begin();
+        tlb_cache_stats.misses++;
+        tlb_cache_stats.reprograms += reprogram ? 1 : 0;
+    }
 
-    free_tlb_indices_2M_UC.pop_back();
+    auto entry = tlb_cache.begin();
+    entry->users++;
+
+    void* memory = bar0 + (tlb_size * entry->tlb_index) + local_offset;
+    auto release = [this, entry]() {
+        std::scoped_lock lock(tlb_cache_mutex);
+        entry->users--;
+    };
 
     return std::make_unique<BlackholeTLB>(memory, apparent_size, release);
 }
 
-std::unique_ptr<TlbWindow> BlackholePciDevice::map_tlb_4G(uint32_t x, uint32_t y, uint64_t address)
+TlbCacheStats BlackholePciDevice::get_tlb_cache_stats()
+{
+    std::scoped_lock lock(tlb_cache_mutex);
+    return tlb_cache_stats;
+}
+
+void BlackholePciDevice::flush_tlb_cache()
 {
-    std::scoped_lock lock(tlb_mutex);
+    std::scoped_lock lock(tlb_cache_mutex);
+
+    for (auto it = tlb_cache.begin(); it != tlb_cache.end();) {
+        if (it->users != 0) {
+            ++it;
+            continue;
+        }
+
+        auto& free_tlb_indices = tlb_cache_key_is_wc(it->key) ? free_tlb_indices_2M_WC : free_tlb_indices_2M_UC;
+        free_tlb_indices.release(it->tlb_index);
+        tlb_cache_lookup.erase(it->key);
+        it = tlb_cache.erase(it);
+    }
+}
+
+std::optional<size_t> BlackholePciDevice::evict_cached_tlb_index_2M(bool wc)
+{
+    for (auto it = tlb_cache.rbegin(); it != tlb_cache.rend(); ++it) {
+        if (it->users == 0 && tlb_cache_key_is_wc(it->key) == wc) {
+            const size_t tlb_index = it->tlb_index;
+            tlb_cache_lookup.erase(it->key);
+            tlb_cache.erase(std::next(it).base());
+            return tlb_index;
+        }
+    }
+    return std::nullopt;
+}
 
-    if (free_tlb_indices_4G.empty()) {
+std::unique_ptr<TlbWindow> BlackholePciDevice::map_tlb_4G(uint32_t x, uint32_t y, uint64_t address,
+                                                          const TlbOptions& options)
+{
+    const auto tlb_config = make_tlb_config<pcie::Tlb4G>(x, y, address >> 32, options);
+    auto tlb_index = free_tlb_indices_4G.allocate();
+
+    if (!tlb_index) {
         throw std::runtime_error("No free 4GiB TLB entries available");
     }
 
     const size_t tlb_size = 1ULL << 32;
     const size_t tlb_mask = tlb_size - 1;
-    const size_t tlb_index = free_tlb_indices_4G.back();
     const uint64_t local_offset = address & tlb_mask;
     const size_t apparent_size = tlb_size - local_offset;
 
-    pcie::Tlb4G tlb_config{};
-    tlb_config.address = address >> 32;
-    tlb_config.x_end = x;
-    tlb_config.y_end = y;
-
-    write_tlb_config_4G(tlb_index, tlb_config);
-
-    void* memory = bar4 + (tlb_size * (tlb_index - BH_4G_TLB_START)) + local_offset;
-    auto release = [this, tlb_index]() {
-        std::scoped_lock lock(tlb_mutex);
-        free_tlb_indices_4G.push_back(tlb_index);
-    };
+    write_tlb_config_4G(*tlb_index, tlb_config);
 
-    free_tlb_indices_4G.pop_back();
+    void* memory = bar4 + (tlb_size * (*tlb_index - BH_4G_TLB_START)) + local_offset;
+    auto release = [this, tlb_index = *tlb_index]() { free_tlb_indices_4G.release(tlb_index); };
 
     return std::make_unique<BlackholeTLB>(memory, apparent_size, release);
 }
 
 uint64_t BlackholePciDevice::map_for_dma(const void* buffer, size_t size)
 {
-    tenstorrent_pin_pages pin{};
-    pin.in.output_size_bytes = sizeof(pin.out);
-    pin.in.virtual_address = reinterpret_cast<uint64_t>(buffer);
-    pin.in.size = size;
-    // pin.in.flags = TENSTORRENT_PIN_PAGES_INTO_IOMMU;
+    return dma_cache.map(reinterpret_cast<uint64_t>(buffer), size);
+}
 
-    // If this is failing on you, check that the buffer is page-aligned and
-    // that the size is a multiple of the page size.  Also that IOMMU is on.
-    IOCTL(fd, TENSTORRENT_IOCTL_PIN_PAGES, &pin);
+std::unique_ptr<AsyncDmaPin> BlackholePciDevice::map_for_dma_async(const void* buffer, size_t size, size_t chunk_size)
+{
+    return std::make_unique<AsyncDmaPin>(*this, buffer, size, chunk_size);
+}
 
-    return pin.out.physical_address;
+void BlackholePciDevice::unmap_for_dma(uint64_t iova)
+{
+    dma_cache.unmap(iova);
+}
+
+void BlackholePciDevice::set_dma_cache_retain(bool retain)
+{
+    dma_cache.set_retain_idle(retain);
+}
+
+void BlackholePciDevice::set_dma_pin_budget(size_t bytes)
+{
+    dma_cache.set_budget(bytes);
+}
+
+void BlackholePciDevice::flush_dma_cache()
+{
+    dma_cache.flush();
+}
+
+void BlackholePciDevice::invalidate_dma_cache(const void* buffer, size_t size)
+{
+    dma_cache.invalidate(reinterpret_cast<uint64_t>(buffer), size);
+}
+
+DmaCacheStats BlackholePciDevice::get_dma_cache_stats()
+{
+    return dma_cache.get_stats();
+}
+
+DriverDmaBuffer BlackholePciDevice::allocate_driver_dma_buffer(size_t size)
+{
+    std::scoped_lock lock(driver_dma_mutex);
+
+    if (driver_dma_buffers.size() >= TENSTORRENT_MAX_DMA_BUFS) {
+        throw std::runtime_error("Out of driver DMA buffer slots");
+    }
+    if (size == 0 || size > UINT32_MAX) {
+        throw std::invalid_argument("Bad driver DMA buffer size");
+    }
+
+    if (emulation) {
+        driver_dma_buffers.push_back(emulation->allocate_dma_buffer(size));
+        return driver_dma_buffers.back();
+    }
+
+    tenstorrent_allocate_dma_buf allocate{};
+    allocate.in.requested_size = size;
+    allocate.in.buf_index = driver_dma_buffers.size();
+
+    IOCTL(fd, TENSTORRENT_IOCTL_ALLOCATE_DMA_BUF, &allocate);
+
+    void* memory =
+        mmap(nullptr, allocate.out.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, allocate.out.mapping_offset);
+    if (memory == MAP_FAILED) {
+        // The slot is taken either way; don't hand its index out again.
+        driver_dma_buffers.push_back(DriverDmaBuffer{nullptr, 0, 0});
+        throw std::runtime_error("Failed to map driver DMA buffer");
+    }
+
+    DriverDmaBuffer buffer{static_cast<uint8_t*>(memory), allocate.out.physical_address, allocate.out.size};
+    driver_dma_buffers.push_back(buffer);
+    return buffer;
+}
+
+uint64_t BlackholePciDevice::map_peer_bar(BlackholePciDevice& peer, uint32_t bar_index, uint64_t offset,
+                                          uint64_t length)
+{
+    static constexpr uint64_t PAGE_MASK = 0xFFF;
+
+    if (&peer == this) {
+        throw std::invalid_argument("Peer must be a different device");
+    }
+    if (bar_index != 0 && bar_index != 2 && bar_index != 4) {
+        throw std::invalid_argument("Bad peer BAR index");
+    }
+    if (length == 0 || (offset & PAGE_MASK) || (length & PAGE_MASK) || offset > UINT32_MAX || length > UINT32_MAX) {
+        throw std::invalid_argument("Bad peer BAR range");
+    }
+
+    if (emulation || peer.emulation) {
+        if (!emulation || !peer.emulation) {
+            throw std::runtime_error("Cannot mix emulated and real devices");
+        }
+        // Like pinning: the "bus address" is the peer's virtual address.
+        uint8_t* bar = bar_index == 0 ? peer.bar0 : (bar_index == 2 ? peer.bar2 : peer.bar4);
+        return reinterpret_cast<uint64_t>(bar + offset);
+    }
+
+    tenstorrent_map_peer_bar map{};
+    map.in.peer_fd = peer.fd;
+    map.in.peer_bar_index = bar_index;
+    map.in.peer_bar_offset = offset;
+    map.in.peer_bar_length = length;
+
+    IOCTL(fd, TENSTORRENT_IOCTL_MAP_PEER_BAR, &map);
+
+    return map.out.dma_address;
+}
+
+uint64_t BlackholePciDevice::map_peer_window(BlackholePciDevice& peer, TlbWindow& window)
+{
+    static constexpr uint64_t PAGE_MASK = 0xFFF;
+
+    uint8_t* begin = window.as<uint8_t*>();
+    uint32_t bar_index;
+    uint64_t offset;
+    if (begin >= peer.bar0 && begin < peer.bar0 + BAR0_SIZE) {
+        bar_index = 0;
+        offset = begin - peer.bar0;
+    } else if (begin >= peer.bar4 && begin < peer.bar4 + BAR4_SIZE) {
+        bar_index = 4;
+        offset = begin - peer.bar4;
+    } else {
+        throw std::invalid_argument("Window does not belong to peer");
+    }
+
+    // The window may start part way into a page; see map_tlb_2M_WC.
+    const uint64_t aligned = offset & ~PAGE_MASK;
+    const uint64_t length = (offset - aligned + window.size() + PAGE_MASK) & ~PAGE_MASK;
+
+    return map_peer_bar(peer, bar_index, aligned, length) + (offset - aligned);
 }
 
 void BlackholePciDevice::configure_iatu_region(size_t region, uint64_t base, uint64_t target, size_t size)
@@ -378,8 +810,6 @@ void BlackholePciDevice::configure_iatu_region(size_t region, uint64_t base, uin
         *reinterpret_cast<volatile uint32_t *>(bar2 + offset) = value;
     };
 
-    std::cout << "size is " << size << std::endl;
-
     uint64_t limit = (base + (size - 1));
     uint32_t limit_lo = (limit >> 0x00) & 0xffffffff;
     uint32_t limit_hi = (limit >> 0x20) & 0xffffffff;
@@ -387,16 +817,15 @@ void BlackholePciDevice::configure_iatu_region(size_t region, uint64_t base, uin
     uint32_t base_hi = (base >> 0x20) & 0xffff'ffff;
     uint32_t target_lo = (target >> 0x00) & 0xffff'ffff;
     uint32_t target_hi = (target >> 0x20) & 0xffff'ffff;
-    std::cout << "limit is " << limit << std::endl;
-    std::cout << "limit_lo is " << limit_lo << std::endl;
-    std::cout << "limit_hi is " << limit_hi << std::endl;
 
     uint32_t region_ctrl_1 = 1 << 13;  // INCREASE_REGION_SIZE
     uint32_t region_ctrl_2 = 1 << 31;  // REGION_EN
     uint32_t region_ctrl_3 = 0;
 
+    // Disabled while the addresses change, enabled last: a region that is
+    // being reprogrammed never translates with half-written bounds.
+    write_iatu_reg(iatu_base + 0x04, 0);
     write_iatu_reg(iatu_base + 0x00, region_ctrl_1);
-    write_iatu_reg(iatu_base + 0x04, region_ctrl_2);
     write_iatu_reg(iatu_base + 0x08, base_lo);
     write_iatu_reg(iatu_base + 0x0c, base_hi);
     write_iatu_reg(iatu_base + 0x10, limit_lo);
@@ -404,6 +833,19 @@ void BlackholePciDevice::configure_iatu_region(size_t region, uint64_t base, uin
     write_iatu_reg(iatu_base + 0x18, target_hi);
     write_iatu_reg(iatu_base + 0x1c, region_ctrl_3);
     write_iatu_reg(iatu_base + 0x20, limit_hi);
+    write_iatu_reg(iatu_base + 0x04, region_ctrl_2);
+}
+
+void BlackholePciDevice::disable_iatu_region(size_t region)
+{
+    static constexpr uint64_t ATU_OFFSET_IN_BH_BAR2 = 0x1200;
+    uint64_t iatu_base = ATU_OFFSET_IN_BH_BAR2 + (region * 0x200);
+
+    if (bar2 == nullptr || bar2 == MAP_FAILED) {
+        throw std::runtime_error("BAR2 not mapped");
+    }
+
+    *reinterpret_cast<volatile uint32_t *>(bar2 + iatu_base + 0x04) = 0; // region_ctrl_2: clear REGION_EN
 }
 
 void BlackholePciDevice::dump_iatu_region(size_t region)
@@ -454,6 +896,10 @@ void BlackholePciDevice::write_tlb_config_2M(size_t tlb_index, const pcie::Tlb2M
     dst[2] = tlb_config.data[2];
 
     mfence();
+
+    if (emulation) {
+        emulate_tlb_config_2M(tlb_index, tlb_config);
+    }
 }
 
 void BlackholePciDevice::write_tlb_config_4G(size_t tlb_index, const pcie::Tlb4G& tlb_config)
@@ -468,6 +914,19 @@ void BlackholePciDevice::write_tlb_config_4G(size_t tlb_index, const pcie::Tlb4G
     dst[1] = tlb_config.data[1];
     dst[2] = tlb_config.data[2];
     mfence();
+
+    if (emulation) {
+        const size_t tlb_size = 1ULL << 32;
+        uint8_t* window = bar4 + (tlb_size * (tlb_index - BH_4G_TLB_START));
+        emulation->retarget(window, tlb_size, tlb_config.x_end, tlb_config.y_end, uint64_t(tlb_config.address) << 32);
+    }
+}
+
+void BlackholePciDevice::emulate_tlb_config_2M(size_t tlb_index, const pcie::Tlb2M& tlb_config)
+{
+    const size_t tlb_size = 1ULL << 21;
+    uint8_t* window = bar0 + (tlb_size * tlb_index);
+    emulation->retarget(window, tlb_size, tlb_config.x_end, tlb_config.y_end, uint64_t(tlb_config.address) << 21);
 }
 
 pcie::Tlb2M BlackholePciDevice::read_tlb_config_2M(size_t tlb_index)
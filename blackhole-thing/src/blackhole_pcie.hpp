@@ -1,10 +1,16 @@
 #pragma once
 
+#include <list>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "async_dma_pin.hpp"
+#include "dma_registration_cache.hpp"
+#include "tlb_index_pool.hpp"
 #include "tlb_window.hpp"
 
 namespace tt {
@@ -25,8 +31,100 @@ struct Tlb2M;
 struct Tlb4G;
 } // namespace pcie
 
+/**
+ * @brief Transaction ordering for NOC requests issued through a TLB window.
+ */
+enum class TlbOrdering : uint8_t {
+    Relaxed = 0,
+    Strict = 1,
+    Posted = 2, // writes do not wait for an acknowledgement
+};
+
+/**
+ * @brief TLB window attributes beyond the target (x, y, address).
+ *
+ * Defaults match what map_tlb_* has always programmed: unicast, relaxed
+ * ordering, NOC0, dynamic VC.
+ *
+ * For multicast, the (x, y) passed to map_tlb_* is the end corner of the
+ * rectangle and (x_start, y_start) is the start corner; on NOC0 the start
+ * corner must not be greater than the end corner in either dimension.  Every
+ * tile in the rectangle receives each write, so don't let the rectangle cover
+ * tiles that should not see it.  Reads through a multicast window are not
+ * meaningful.
+ *
+ * Coordinates are interpreted in the coordinate system of the selected NOC.
+ */
+struct TlbOptions
+{
+    bool multicast = false;
+    uint32_t x_start = 0;
+    uint32_t y_start = 0;
+    TlbOrdering ordering = TlbOrdering::Relaxed;
+    uint32_t noc = 0;
+    bool use_static_vc = false;
+    uint32_t static_vc = 0;
+    bool linked = false;
+
+    /**
+     * @brief Options for a multicast window covering (x_start, y_start) to
+     * the (x, y) given to map_tlb_*.
+     */
+    static TlbOptions multicast_from(uint32_t x_start, uint32_t y_start)
+    {
+        TlbOptions options{};
+        options.multicast = true;
+        options.x_start = x_start;
+        options.y_start = y_start;
+        return options;
+    }
+};
+
+/**
+ * @brief One window's worth of map_tlbs_2M_* request.
+ */
+struct TlbTarget
+{
+    uint32_t x;
+    uint32_t y;
+    uint64_t address;
+    TlbOptions options = {};
+};
+
+/**
+ * @brief Counters for the 2 MiB window cache.
+ *
+ * hits:       lookups satisfied by a window that was already programmed
+ * misses:     lookups that had to program a window
+ * reprograms: misses satisfied by retargeting an idle cached window
+ * evictions:  cached windows taken away to satisfy uncached map_tlb_* calls
+ */
+struct TlbCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t reprograms;
+    uint64_t evictions;
+};
+
+/**
+ * @brief A physically contiguous buffer allocated by TT-KMD.
+ *
+ * memory: where it is mapped in this process
+ * iova:   address the device uses to reach it
+ */
+struct DriverDmaBuffer
+{
+    uint8_t* memory;
+    uint64_t iova;
+    size_t size;
+};
+
+class EmulatedDevice;
+
 class BlackholePciDevice
 {
+    std::unique_ptr<EmulatedDevice> emulation; // null for real hardware
     const int fd;
     const PciDeviceInfo info;
     const size_t bar0_size;
@@ -44,19 +142,44 @@ class BlackholePciDevice
     // dosn't know how to coordinate with other userspace programs that might
     // steal its TLB window.  Moving TLB window management to the kernel driver
     // eliminates this category of problem.
-    std::mutex tlb_mutex;
-    std::vector<size_t> free_tlb_indices_2M_WC;
-    std::vector<size_t> free_tlb_indices_2M_UC;
-    std::vector<size_t> free_tlb_indices_4G;
+    TlbIndexPool free_tlb_indices_2M_WC;
+    TlbIndexPool free_tlb_indices_2M_UC;
+    TlbIndexPool free_tlb_indices_4G;
+
+    // Windows that stay programmed after the caller is done with them, so that
+    // repeated small accesses to the same 2 MiB page don't pay for a TLB
+    // reprogram each time.  Most recently used at the front.  An entry with
+    // users > 0 is borrowed and must not be retargeted.
+    struct CachedTlb
+    {
+        uint64_t key;
+        size_t tlb_index;
+        size_t users;
+    };
+    std::mutex tlb_cache_mutex;
+    std::list<CachedTlb> tlb_cache;
+    std::unordered_map<uint64_t, std::list<CachedTlb>::iterator> tlb_cache_lookup;
+    TlbCacheStats tlb_cache_stats{};
+
+    DmaRegistrationCache dma_cache;
+
+    std::mutex driver_dma_mutex;
+    std::vector<DriverDmaBuffer> driver_dma_buffers; // index is buf_index
 
 public:
+    /**
+     * @brief Pass as the path to get an in-process emulation instead of
+     * hardware.  See EmulatedDevice.
+     */
+    static constexpr const char* EMULATED = "emulated";
+
     /**
      * @brief Construct a new BlackholePciDevice object.
      *
      * Opens the device file, reads the device info, and maps the BARs.
      * TODO: We don't do any device enumeration yet.
      *
-     * @param path  e.g. /dev/tenstorrent/0
+     * @param path  e.g. /dev/tenstorrent/0, or EMULATED
      */
     BlackholePciDevice(const std::string& path);
 
@@ -74,6 +197,11 @@ public:
      */
     const PciDeviceInfo& get_info() const { return info; }
 
+    /**
+     * @brief The emulation backing this device, or nullptr for hardware.
+     */
+    EmulatedDevice* get_emulation() { return emulation.get(); }
+
     /**
      * @brief Map a window of memory to an (x, y, address) location in the chip.
      *
@@ -83,27 +211,105 @@ public:
      * is for the caller to worry about it, but this turned out to be error
      * prone and annoying.
      *
-     * @param x NOC0 coordinate of tile
-     * @param y NOC0 coordinate of tile
+     * @param x NOC0 coordinate of tile (multicast: end corner)
+     * @param y NOC0 coordinate of tile (multicast: end corner)
      * @param address within tile
+     * @param options multicast, ordering, NOC selection, etc.
      * @return std::unique_ptr<TlbWindow> must not outlive BlackholePciDevice!
      */
-    std::unique_ptr<TlbWindow> map_tlb_2M_WC(uint32_t x, uint32_t y, uint64_t address);
-    std::unique_ptr<TlbWindow> map_tlb_2M_UC(uint32_t x, uint32_t y, uint64_t address);
-    std::unique_ptr<TlbWindow> map_tlb_4G(uint32_t x, uint32_t y, uint64_t address);
-    // TODO: the interface above is too simplistic.  TLB configuration supports
-    // broadcast, has ordering bits, NOC bits, and so on.  Live with this for
-    // now, but consider how to expose these features while maintaining an
-    // ergonomic interface.
-    //
+    std::unique_ptr<TlbWindow> map_tlb_2M_WC(uint32_t x, uint32_t y, uint64_t address, const TlbOptions& options = {});
+    std::unique_ptr<TlbWindow> map_tlb_2M_UC(uint32_t x, uint32_t y, uint64_t address, const TlbOptions& options = {});
+    std::unique_ptr<TlbWindow> map_tlb_4G(uint32_t x, uint32_t y, uint64_t address, const TlbOptions& options = {});
+
+    /**
+     * @brief Map many 2 MiB windows at once.
+     *
+     * map_tlb_* fences before and after every TLB reprogram.  When touching
+     * many tiles, those fences cost more than the accesses they enable.  This
+     * programs every window with one fence before the first configuration
+     * write and one after the last.
+     *
+     * All or nothing: if there are not enough free windows, none are mapped.
+     *
+     * @param targets one window per entry, same semantics as map_tlb_2M_*
+     * @return windows in the same order as targets; each one releases its TLB
+     * entry independently.  Must not outlive BlackholePciDevice!
+     */
+    std::vector<std::unique_ptr<TlbWindow>> map_tlbs_2M_WC(const std::vector<TlbTarget>& targets);
+    std::vector<std::unique_ptr<TlbWindow>> map_tlbs_2M_UC(const std::vector<TlbTarget>& targets);
+
     // There is also the question of how and where to translate coordinates.  I
     // don't have an answer to that other than NOT HERE!  That is a problem for
     // an abstraction layer higher up, where it is easier to test the coordinate
     // transformation mechanism(s) without needing any hardware.
 
+    /**
+     * @brief As map_tlb_2M_WC/UC, but the window stays programmed afterwards.
+     *
+     * The returned object borrows a cached window; destroying it does not
+     * release the TLB entry.  A later request for the same (x, y, 2 MiB page)
+     * and caching mode gets the same window back without touching the TLB
+     * configuration registers.  When the pool runs dry, the least recently
+     * used idle window is retargeted.  Intended for register pokes, where the
+     * TLB reprogram would otherwise cost more than the access itself.  Cached
+     * windows always use the default TlbOptions.
+     *
+     * @param x NOC0 coordinate of tile
+     * @param y NOC0 coordinate of tile
+     * @param address within tile
+     * @return std::unique_ptr<TlbWindow> must not outlive BlackholePciDevice!
+     */
+    std::unique_ptr<TlbWindow> map_tlb_2M_WC_cached(uint32_t x, uint32_t y, uint64_t address);
+    std::unique_ptr<TlbWindow> map_tlb_2M_UC_cached(uint32_t x, uint32_t y, uint64_t address);
+
+    /**
+     * @brief Window cache counters since construction.
+     */
+    TlbCacheStats get_tlb_cache_stats();
+
+    /**
+     * @brief Return every idle cached window to the free pool.
+     */
+    void flush_tlb_cache();
+
+    /**
+     * @brief Copy host memory to an arbitrarily large NOC address range.
+     *
+     * Unlike TlbWindow::write_block, the range may cross any number of 2 MiB
+     * window boundaries.  Two WC windows are used in ping-pong fashion: the
+     * window for the next 2 MiB chunk is programmed before the current chunk
+     * is copied, so the TLB reprogram overlaps with the data transfer instead
+     * of stalling between chunks.
+     *
+     * @param x NOC0 coordinate of tile
+     * @param y NOC0 coordinate of tile
+     * @param address within tile, any alignment
+     * @param src host buffer
+     * @param size in bytes
+     */
+    void write(uint32_t x, uint32_t y, uint64_t address, const void* src, size_t size);
+
+    /**
+     * @brief Copy an arbitrarily large NOC address range to host memory.
+     *
+     * See write().
+     *
+     * @param x NOC0 coordinate of tile
+     * @param y NOC0 coordinate of tile
+     * @param address within tile, any alignment
+     * @param dst host buffer
+     * @param size in bytes
+     */
+    void read(uint32_t x, uint32_t y, uint64_t address, void* dst, size_t size);
+
     /**
      * @brief Map user-allocated memory for DMA access.
      *
+     * Goes through a registration cache: if the range is already pinned
+     * (e.g. it overlaps another live mapping, or set_dma_cache_retain() kept
+     * an earlier pin), this takes a reference on the existing pin instead of
+     * pinning again.  See DmaRegistrationCache.
+     *
      * @param buffer constraint: must be page-aligned
      * @param size constraint: must be a multiple of the page size
      * @return uint64_t IOVA address for DMA access
@@ -111,13 +317,94 @@ public:
     uint64_t map_for_dma(const void* buffer, size_t size);
 
     /**
-     * @brief Unmap user-allocated memory from DMA access.
+     * @brief Map a large buffer for DMA in chunks, on a background thread.
+     *
+     * Returns immediately.  The returned object says how much of the buffer
+     * is device-visible so far; see AsyncDmaPin.  It must not outlive this.
+     *
+     * @param buffer constraint: must be page-aligned
+     * @param size constraint: must be a multiple of the page size
+     * @param chunk_size bytes pinned per ioctl
+     */
+    std::unique_ptr<AsyncDmaPin> map_for_dma_async(const void* buffer, size_t size, size_t chunk_size = 1ULL << 30);
+
+    /**
+     * @brief Drop the reference taken by map_for_dma.
+     *
+     * The pages are unpinned once nothing else maps them, unless
+     * set_dma_cache_retain(true) is in effect.
+     *
+     * @param iova as returned by map_for_dma
+     */
+    void unmap_for_dma(uint64_t iova);
+
+    /**
+     * @brief Keep pins cached after their last unmap_for_dma.
      *
-     * KMD does not implement this, but it will unmap when the process exits.
+     * Makes re-mapping the same buffer cheap, but the caller must then call
+     * invalidate_dma_cache() before freeing any memory it has mapped; a
+     * stale pin gives a new allocation at the same address the IOVA of the
+     * old pages.  Default is off.
+     */
+    void set_dma_cache_retain(bool retain);
+
+    /**
+     * @brief Limit on pinned host memory.  Idle pins are released, least
+     * recently used first, to stay under it.  Default is unlimited.
+     */
+    void set_dma_pin_budget(size_t bytes);
+
+    /**
+     * @brief Unpin every buffer that has no outstanding map_for_dma.
+     */
+    void flush_dma_cache();
+
+    /**
+     * @brief Unpin cached pins of memory that is about to be freed.
      *
-     * @param iova ignored
+     * @param buffer start of the memory
+     * @param size of the memory
      */
-    void unmap_for_dma(uint64_t iova) { /* TODO */ }
+    void invalidate_dma_cache(const void* buffer, size_t size);
+
+    DmaCacheStats get_dma_cache_stats();
+
+    /**
+     * @brief Ask TT-KMD for a physically contiguous DMA buffer.
+     *
+     * Each call costs an ioctl and one of the 256 buffer slots per open file,
+     * and TT-KMD only frees them when the device file is closed.  For lots of
+     * small buffers, use a DmaArena instead.
+     *
+     * @param size in bytes; TT-KMD limits this (max_dma_buf_size_log2)
+     * @throws std::runtime_error if the slots are used up or the ioctl fails
+     */
+    DriverDmaBuffer allocate_driver_dma_buffer(size_t size);
+
+    /**
+     * @brief Make part of another card's BAR reachable from this card.
+     *
+     * TT-KMD maps the range for peer-to-peer DMA from this device and keeps
+     * it mapped until this device file is closed.  The result is a bus
+     * address; reach it from this card's NOC through an ATU-bypass outbound
+     * TLB entry (PCIeCore::map_outbound) at that entry's base + the address.
+     *
+     * @param peer another card, open in this process
+     * @param bar_index 0, 2 or 4
+     * @param offset into the BAR; page-aligned, below 4 GiB
+     * @param length page multiple, below 4 GiB
+     * @return bus address of peer's BAR + offset, as seen by this device
+     */
+    uint64_t map_peer_bar(BlackholePciDevice& peer, uint32_t bar_index, uint64_t offset, uint64_t length);
+
+    /**
+     * @brief map_peer_bar for the part of peer's BAR behind one of peer's
+     * TLB windows, so this card can write wherever that window points.
+     *
+     * @param window from peer.map_tlb_*; must stay mapped while in use
+     * @return bus address of the window's first byte
+     */
+    uint64_t map_peer_window(BlackholePciDevice& peer, TlbWindow& window);
 
     /**
      * @brief Low-level access to the PCIe BARs.
@@ -132,10 +419,44 @@ public:
     uint8_t* get_bar2() { return bar2; }
     uint8_t* get_bar4() { return bar4; }
 
+    /**
+     * @brief Program outbound iATU region: [base, base + size) in the PCIe
+     * core's outbound space goes to [target, target + size) on the host.
+     *
+     * Silent; use dump_iatu_region to see what got programmed.  For more than
+     * one region, use IatuRegionManager instead of picking indices by hand.
+     */
     void configure_iatu_region(size_t region, uint64_t base, uint64_t target, size_t size);
+    void disable_iatu_region(size_t region);
     void dump_iatu_region(size_t region);
 
 private:
+    std::unique_ptr<TlbWindow> map_tlb_2M(uint32_t x, uint32_t y, uint64_t address, bool wc,
+                                          const TlbOptions& options);
+    std::vector<std::unique_ptr<TlbWindow>> map_tlbs_2M(const std::vector<TlbTarget>& targets, bool wc);
+    std::unique_ptr<TlbWindow> map_tlb_2M_cached(uint32_t x, uint32_t y, uint64_t address, bool wc);
+    void stream(uint32_t x, uint32_t y, uint64_t address, uint8_t* host, size_t size, bool to_device);
+
+    /**
+     * @brief Take a 2 MiB TLB index from the free pool.
+     *
+     * If the pool is empty, an idle cached window is evicted to make room.
+     *
+     * @param wc which pool
+     * @return TLB index, caller owns it and must release it to the pool
+     */
+    size_t allocate_tlb_index_2M(bool wc);
+
+    /**
+     * @brief Evict the least recently used idle cached window.
+     *
+     * Caller must hold tlb_cache_mutex.
+     *
+     * @param wc which pool
+     * @return TLB index (caller owns it), or nothing if no window is idle
+     */
+    std::optional<size_t> evict_cached_tlb_index_2M(bool wc);
+
     /**
      * @brief Inbound PCIe TLB configuration registers.
      *
@@ -156,6 +477,11 @@ private:
     void write_tlb_config_2M(size_t tlb_index, const pcie::Tlb2M& tlb_config);
     void write_tlb_config_4G(size_t tlb_index, const pcie::Tlb4G& tlb_config);
 
+    /**
+     * @brief Make an emulated 2 MiB window follow its configuration registers.
+     */
+    void emulate_tlb_config_2M(size_t tlb_index, const pcie::Tlb2M& tlb_config);
+
     /**
      * @brief Read inbound PCIe TLB configuration registers.
      *
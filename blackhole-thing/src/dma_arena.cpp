@@ -0,0 +1,158 @@
+#include "dma_arena.hpp"
+
+#include "blackhole_pcie.hpp"
+
+#include <stdexcept>
+
+namespace tt {
+
+static bool is_power_of_two(size_t x)
+{
+    return x && !(x & (x - 1));
+}
+
+DmaArena::DmaArena(BlackholePciDevice& device, size_t slab_size)
+    : device(device)
+    , slab_size(slab_size)
+{
+    if (!is_power_of_two(slab_size) || slab_size < (1ULL << MIN_BLOCK_SHIFT) ||
+        slab_size > (1ULL << MAX_BLOCK_SHIFT)) {
+        throw std::invalid_argument("DmaArena slab size must be a power of two between 4 KiB and 1 GiB");
+    }
+}
+
+DmaAllocation DmaArena::allocate(size_t size)
+{
+    if (size > slab_size) {
+        throw std::invalid_argument("DmaArena allocation larger than a slab");
+    }
+
+    const size_t cls = size_class(size);
+    const size_t block_size = 1ULL << (cls + MIN_BLOCK_SHIFT);
+
+    std::scoped_lock lock(mutex);
+
+    if (!free_lists[cls]) {
+        // A block has to be aligned to its size within the slab.  If the tail
+        // can't provide one, give the tail to the free lists and look there.
+        const size_t offset = slab_size - tail_size;
+        if (tail_size < block_size || (offset & (block_size - 1))) {
+            retire_slab_tail();
+            split_larger(cls);
+        }
+
+        if (!free_lists[cls] && tail_size == 0) {
+            const DriverDmaBuffer slab = device.allocate_driver_dma_buffer(slab_size);
+            if (slab.size < slab_size) {
+                throw std::runtime_error("TT-KMD returned a short DMA buffer");
+            }
+            tail_memory = slab.memory;
+            tail_iova = slab.iova;
+            tail_size = slab_size;
+            stats.slabs++;
+            stats.slab_bytes += slab_size;
+        }
+
+        if (!free_lists[cls]) {
+            push(cls, tail_memory, tail_iova);
+            tail_memory += block_size;
+            tail_iova += block_size;
+            tail_size -= block_size;
+        }
+    }
+
+    FreeBlock* block = free_lists[cls];
+    free_lists[cls] = block->next;
+
+    stats.in_use_bytes += block_size;
+    stats.allocations++;
+
+    return DmaAllocation{block, block->iova, block_size};
+}
+
+void DmaArena::free(const DmaAllocation& allocation)
+{
+    if (!allocation.memory) {
+        return;
+    }
+
+    const size_t cls = size_class(allocation.size);
+
+    std::scoped_lock lock(mutex);
+    push(cls, static_cast<uint8_t*>(allocation.memory), allocation.iova);
+    stats.in_use_bytes -= allocation.size;
+}
+
+DmaArenaStats DmaArena::get_stats()
+{
+    std::scoped_lock lock(mutex);
+    return stats;
+}
+
+size_t DmaArena::size_class(size_t size)
+{
+    if (size <= (1ULL << MIN_BLOCK_SHIFT)) {
+        return 0;
+    }
+    return 64 - __builtin_clzll(size - 1) - MIN_BLOCK_SHIFT;
+}
+
+void DmaArena::push(size_t cls, uint8_t* memory, uint64_t iova)
+{
+    auto* block = reinterpret_cast<FreeBlock*>(memory);
+    block->next = free_lists[cls];
+    block->iova = iova;
+    free_lists[cls] = block;
+}
+
+// Take the smallest free block bigger than class cls and halve it down to cls,
+// pushing the upper half at each step.  Blocks are aligned to their size, so
+// the halves are too.
+bool DmaArena::split_larger(size_t cls)
+{
+    size_t from = cls + 1;
+    while (from < NUM_CLASSES && !free_lists[from]) {
+        from++;
+    }
+    if (from == NUM_CLASSES) {
+        return false;
+    }
+
+    FreeBlock* block = free_lists[from];
+    free_lists[from] = block->next;
+
+    auto* memory = reinterpret_cast<uint8_t*>(block);
+    const uint64_t iova = block->iova;
+    while (from > cls) {
+        from--;
+        const size_t half = 1ULL << (from + MIN_BLOCK_SHIFT);
+        push(from, memory + half, iova + half);
+    }
+    push(cls, memory, iova);
+    return true;
+}
+
+// Hand the rest of the current slab to the free lists as the largest aligned
+// blocks that fit, so switching to a new slab doesn't waste it.
+void DmaArena::retire_slab_tail()
+{
+    while (tail_size) {
+        const size_t offset = slab_size - tail_size;
+        size_t cls = NUM_CLASSES - 1;
+        while (cls > 0) {
+            const size_t block_size = 1ULL << (cls + MIN_BLOCK_SHIFT);
+            if (block_size <= tail_size && !(offset & (block_size - 1))) {
+                break;
+            }
+            cls--;
+        }
+
+        const size_t block_size = 1ULL << (cls + MIN_BLOCK_SHIFT);
+        push(cls, tail_memory, tail_iova);
+        tail_memory += block_size;
+        tail_iova += block_size;
+        tail_size -= block_size;
+    }
+}
+
+} // namespace tt
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace tt {
+
+class BlackholePciDevice;
+
+/**
+ * @brief A piece of DMA-able memory handed out by DmaArena.
+ */
+struct DmaAllocation
+{
+    void* memory;  // CPU address
+    uint64_t iova; // device address
+    size_t size;   // rounded up to the size class
+};
+
+/**
+ * @brief Counters for DmaArena.
+ *
+ * slabs:          driver buffers obtained so far
+ * slab_bytes:     their total size
+ * in_use_bytes:   handed out and not yet freed, after rounding up
+ * allocations:    calls to allocate()
+ */
+struct DmaArenaStats
+{
+    uint64_t slabs;
+    uint64_t slab_bytes;
+    uint64_t in_use_bytes;
+    uint64_t allocations;
+};
+
+/**
+ * @brief Sub-allocator for small, short-lived DMA staging buffers.
+ *
+ * Carves a few large driver-allocated (physically contiguous) buffers into
+ * power-of-two size classes, 4 KiB up to the slab size.  Each class has a
+ * free list, so allocate() and free() are a list pop/push in the common case.
+ * When a class is empty, the block comes off the end of the current slab, or
+ * else is split buddy-style from the smallest larger free block, the unused
+ * halves going to the classes below.  Only when neither works is another
+ * slab requested from TT-KMD.  Freed blocks are not merged back.
+ *
+ * Blocks are aligned to their size, so a block never crosses a slab boundary
+ * and its IOVA range is contiguous.
+ *
+ * Free blocks keep their list links in the block itself.  Memory is never
+ * returned to TT-KMD; it goes back when the device file is closed.
+ */
+class DmaArena
+{
+public:
+    static constexpr size_t MIN_BLOCK_SHIFT = 12; // 4 KiB
+    static constexpr size_t MAX_BLOCK_SHIFT = 30; // 1 GiB
+
+    /**
+     * @param slab_size bytes per driver buffer; power of two, >= 4 KiB.  TT-KMD
+     * may refuse sizes above 2^max_dma_buf_size_log2.
+     */
+    DmaArena(BlackholePciDevice& device, size_t slab_size = 4ULL << 20);
+
+    DmaArena(const DmaArena&) = delete;
+    DmaArena& operator=(const DmaArena&) = delete;
+
+    /**
+     * @throws std::invalid_argument if size is larger than a slab
+     * @throws std::runtime_error if TT-KMD won't provide another slab
+     */
+    DmaAllocation allocate(size_t size);
+
+    /**
+     * @param allocation exactly as returned by allocate()
+     */
+    void free(const DmaAllocation& allocation);
+
+    size_t max_allocation() const { return slab_size; }
+
+    DmaArenaStats get_stats();
+
+private:
+    static constexpr size_t NUM_CLASSES = MAX_BLOCK_SHIFT - MIN_BLOCK_SHIFT + 1;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+        uint64_t iova;
+    };
+
+    static size_t size_class(size_t size);
+    void push(size_t cls, uint8_t* memory, uint64_t iova);
+    void retire_slab_tail();
+    bool split_larger(size_t cls);
+
+    BlackholePciDevice& device;
+    const size_t slab_size;
+
+    std::mutex mutex;
+    std::array<FreeBlock*, NUM_CLASSES> free_lists{};
+
+    // Unused end of the most recent slab.
+    uint8_t* tail_memory = nullptr;
+    uint64_t tail_iova = 0;
+    size_t tail_size = 0;
+
+    DmaArenaStats stats{};
+};
+
+} // namespace tt
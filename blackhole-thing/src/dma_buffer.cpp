@@ -0,0 +1,179 @@
+#include "dma_buffer.hpp"
+
+#include "blackhole_pcie.hpp"
+#include "logger.hpp"
+
+#include <sys/mman.h>
+
+#include <stdexcept>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+namespace tt {
+
+static constexpr size_t ONE_GIG = 1ULL << 30;
+static constexpr size_t TWO_MEG = 1ULL << 21;
+static constexpr size_t FOUR_K = 1ULL << 12;
+
+static size_t round_up(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+static void* map_hugetlb(size_t size, int huge_flag)
+{
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge_flag, -1, 0);
+    return p == MAP_FAILED ? nullptr : p;
+}
+
+// Over-allocate by 2 MiB and trim, to get a 2 MiB aligned region that THP can
+// back with huge pages.
+static void* map_transparent(size_t size)
+{
+    const size_t padded = size + TWO_MEG;
+    auto* p = static_cast<uint8_t*>(mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+
+    auto* aligned = reinterpret_cast<uint8_t*>(round_up(reinterpret_cast<uintptr_t>(p), TWO_MEG));
+    const size_t head = aligned - p;
+    const size_t tail = padded - head - size;
+    if (head) {
+        munmap(p, head);
+    }
+    if (tail) {
+        munmap(aligned + size, tail);
+    }
+
+    if (madvise(aligned, size, MADV_HUGEPAGE) != 0) {
+        munmap(aligned, size);
+        return nullptr;
+    }
+
+    return aligned;
+}
+
+static void* map_normal(size_t size)
+{
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? nullptr : p;
+}
+
+DmaBuffer::DmaBuffer(size_t size, DmaPageSize largest)
+    : buffer(nullptr)
+    , buffer_size(0)
+    , mapping_size(0)
+    , kind(largest)
+{
+    if (size == 0) {
+        throw std::invalid_argument("DmaBuffer size must be nonzero");
+    }
+
+    // The enum is ordered largest first, so each case falls through to the
+    // next smaller kind of page.
+    switch (largest) {
+    case DmaPageSize::Huge1G:
+        kind = DmaPageSize::Huge1G;
+        mapping_size = round_up(size, ONE_GIG);
+        if ((buffer = map_hugetlb(mapping_size, MAP_HUGE_1GB))) {
+            break;
+        }
+        [[fallthrough]];
+    case DmaPageSize::Huge2M:
+        kind = DmaPageSize::Huge2M;
+        mapping_size = round_up(size, TWO_MEG);
+        if ((buffer = map_hugetlb(mapping_size, MAP_HUGE_2MB))) {
+            break;
+        }
+        [[fallthrough]];
+    case DmaPageSize::Transparent2M:
+        kind = DmaPageSize::Transparent2M;
+        mapping_size = round_up(size, TWO_MEG);
+        if ((buffer = map_transparent(mapping_size))) {
+            break;
+        }
+        [[fallthrough]];
+    case DmaPageSize::Normal4K:
+        kind = DmaPageSize::Normal4K;
+        mapping_size = round_up(size, FOUR_K);
+        buffer = map_normal(mapping_size);
+        break;
+    }
+
+    if (!buffer) {
+        throw std::runtime_error("Failed to allocate DMA buffer");
+    }
+
+    buffer_size = mapping_size;
+}
+
+DmaBuffer::~DmaBuffer()
+{
+    // Both calls can throw (a failed unpin, or someone else still mapping
+    // part of the buffer).  The memory is freed regardless; anything still
+    // pinned stays pinned until the device is closed.
+    if (device) {
+        try {
+            device->unmap_for_dma(iova);
+        } catch (const std::exception& e) {
+            LOG_ERROR("DmaBuffer: unmap_for_dma failed: {}", e.what());
+        }
+        try {
+            device->invalidate_dma_cache(buffer, buffer_size);
+        } catch (const std::exception& e) {
+            LOG_ERROR("DmaBuffer: invalidate_dma_cache failed: {}", e.what());
+        }
+    }
+    munmap(buffer, mapping_size);
+}
+
+size_t DmaBuffer::page_size() const
+{
+    switch (kind) {
+    case DmaPageSize::Huge1G:
+        return ONE_GIG;
+    case DmaPageSize::Huge2M:
+    case DmaPageSize::Transparent2M:
+        return TWO_MEG;
+    case DmaPageSize::Normal4K:
+        break;
+    }
+    return FOUR_K;
+}
+
+const char* DmaBuffer::page_kind_name() const
+{
+    switch (kind) {
+    case DmaPageSize::Huge1G:
+        return "1 GiB hugetlbfs";
+    case DmaPageSize::Huge2M:
+        return "2 MiB hugetlbfs";
+    case DmaPageSize::Transparent2M:
+        return "2 MiB transparent";
+    case DmaPageSize::Normal4K:
+        break;
+    }
+    return "4 KiB";
+}
+
+uint64_t DmaBuffer::map_for_dma(BlackholePciDevice& device)
+{
+    if (this->device) {
+        return iova;
+    }
+
+    iova = device.map_for_dma(buffer, buffer_size);
+    this->device = &device;
+    return iova;
+}
+
+} // namespace tt
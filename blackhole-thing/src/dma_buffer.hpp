@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tt {
+
+class BlackholePciDevice;
+
+/**
+ * @brief What kind of pages back a DmaBuffer.
+ */
+enum class DmaPageSize {
+    Huge1G,        // hugetlbfs, 1 GiB pages
+    Huge2M,        // hugetlbfs, 2 MiB pages
+    Transparent2M, // 2 MiB aligned, THP requested (kernel may still use 4 KiB)
+    Normal4K,
+};
+
+/**
+ * @brief Host memory for DMA, backed by the largest pages available.
+ *
+ * Pinning 48 GiB of 4 KiB pages means ~12M IOMMU entries; with 1 GiB pages
+ * it's 48.  Fewer, larger mappings pin faster and miss less in the IOTLB
+ * when the device streams host memory.
+ *
+ * Tries, in order and starting from `largest`: 1 GiB hugetlbfs pages, 2 MiB
+ * hugetlbfs pages, a 2 MiB aligned anonymous mapping with MADV_HUGEPAGE, and
+ * plain 4 KiB pages.  Hugetlbfs pages must have been reserved beforehand, e.g.
+ *
+ *   echo 48 > /sys/kernel/mm/hugepages/hugepages-1048576kB/nr_hugepages
+ *
+ * Size is rounded up to a whole number of pages of whatever kind was used.
+ */
+class DmaBuffer
+{
+    void* buffer;
+    size_t buffer_size;
+    size_t mapping_size;
+    DmaPageSize kind;
+
+    BlackholePciDevice* device = nullptr;
+    uint64_t iova = 0;
+
+public:
+    DmaBuffer(size_t size, DmaPageSize largest = DmaPageSize::Huge1G);
+
+    /**
+     * @brief Unmaps from the device (if mapped), drops any cached pin, frees.
+     * Errors while unmapping are logged, not thrown.
+     */
+    ~DmaBuffer();
+
+    DmaBuffer(const DmaBuffer&) = delete;
+    DmaBuffer& operator=(const DmaBuffer&) = delete;
+
+    void* data() { return buffer; }
+    const void* data() const { return buffer; }
+    size_t size() const { return buffer_size; }
+
+    DmaPageSize page_kind() const { return kind; }
+    size_t page_size() const;
+    const char* page_kind_name() const;
+
+    /**
+     * @brief Pin the buffer and map it for device access.
+     *
+     * @param device must outlive this buffer
+     * @return IOVA of the start of the buffer
+     */
+    uint64_t map_for_dma(BlackholePciDevice& device);
+
+    uint64_t get_iova() const { return iova; }
+};
+
+} // namespace tt
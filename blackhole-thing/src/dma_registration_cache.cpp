@@ -0,0 +1,183 @@
+#include "dma_registration_cache.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace tt {
+
+DmaRegistrationCache::DmaRegistrationCache(PinFn pin, UnpinFn unpin)
+    : pin(std::move(pin))
+    , unpin(std::move(unpin))
+{
+}
+
+uint64_t DmaRegistrationCache::map(uint64_t va, size_t size)
+{
+    std::scoped_lock lock(mutex);
+    auto overlaps = overlapping(va, size);
+
+    for (auto registration : overlaps) {
+        if (registration->va <= va && va + size <= registration->va + registration->size) {
+            registration->refs++;
+            registrations.splice(registrations.begin(), registrations, registration);
+            stats.hits++;
+            return registration->iova + (va - registration->va);
+        }
+    }
+
+    // Grow the request to swallow idle neighbours; each overlaps the request,
+    // so the union is still one contiguous range.
+    uint64_t start = va;
+    uint64_t end = va + size;
+    for (auto registration : overlaps) {
+        if (registration->refs == 0) {
+            start = std::min(start, registration->va);
+            end = std::max(end, registration->va + registration->size);
+            remove(registration);
+        }
+    }
+
+    const uint64_t iova = pin(start, end - start);
+
+    registrations.push_front(Registration{start, end - start, iova, 1});
+    by_va.emplace(start, registrations.begin());
+    by_iova.emplace(iova, registrations.begin());
+    largest = std::max(largest, size_t(end - start));
+    stats.misses++;
+    stats.pinned_bytes += end - start;
+
+    enforce_budget();
+
+    return iova + (va - start);
+}
+
+void DmaRegistrationCache::unmap(uint64_t iova)
+{
+    std::scoped_lock lock(mutex);
+
+    const uint64_t lowest = iova >= largest ? iova - largest + 1 : 0;
+    for (auto it = by_iova.lower_bound(lowest); it != by_iova.end() && it->first <= iova; ++it) {
+        auto registration = it->second;
+        if (registration->refs > 0 && iova < registration->iova + registration->size) {
+            registration->refs--;
+            if (registration->refs == 0 && !retain_idle) {
+                remove(registration);
+            } else {
+                enforce_budget();
+            }
+            return;
+        }
+    }
+
+    throw std::invalid_argument("IOVA is not mapped");
+}
+
+void DmaRegistrationCache::set_retain_idle(bool retain)
+{
+    {
+        std::scoped_lock lock(mutex);
+        retain_idle = retain;
+    }
+    if (!retain) {
+        flush();
+    }
+}
+
+void DmaRegistrationCache::set_budget(size_t bytes)
+{
+    std::scoped_lock lock(mutex);
+    budget = bytes;
+    enforce_budget();
+}
+
+void DmaRegistrationCache::flush()
+{
+    std::scoped_lock lock(mutex);
+
+    for (auto it = registrations.begin(); it != registrations.end();) {
+        auto next = std::next(it);
+        if (it->refs == 0) {
+            remove(it);
+        }
+        it = next;
+    }
+}
+
+void DmaRegistrationCache::invalidate(uint64_t va, size_t size)
+{
+    std::scoped_lock lock(mutex);
+    auto overlaps = overlapping(va, size);
+
+    for (auto registration : overlaps) {
+        if (registration->refs != 0) {
+            throw std::runtime_error("Invalidating DMA range that is still mapped");
+        }
+    }
+
+    for (auto registration : overlaps) {
+        remove(registration);
+    }
+}
+
+DmaCacheStats DmaRegistrationCache::get_stats()
+{
+    std::scoped_lock lock(mutex);
+    return stats;
+}
+
+std::vector<DmaRegistrationCache::Iterator> DmaRegistrationCache::overlapping(uint64_t va, size_t size)
+{
+    std::vector<Iterator> result;
+
+    // Nothing that starts more than `largest` bytes below va can reach it.
+    const uint64_t lowest = va >= largest ? va - largest + 1 : 0;
+    for (auto it = by_va.lower_bound(lowest); it != by_va.end() && it->first < va + size; ++it) {
+        auto registration = it->second;
+        if (registration->va + registration->size > va) {
+            result.push_back(registration);
+        }
+    }
+
+    return result;
+}
+
+// Forgets the registration before unpinning it, so that if unpin throws the
+// indices are still consistent; the pages just stay pinned until the device
+// is closed.
+void DmaRegistrationCache::remove(Iterator registration)
+{
+    auto erase_from = [registration](std::multimap<uint64_t, Iterator>& index, uint64_t key) {
+        auto [first, last] = index.equal_range(key);
+        for (auto it = first; it != last; ++it) {
+            if (it->second == registration) {
+                index.erase(it);
+                return;
+            }
+        }
+    };
+
+    const uint64_t va = registration->va;
+    const size_t size = registration->size;
+
+    erase_from(by_va, va);
+    erase_from(by_iova, registration->iova);
+    stats.unpins++;
+    stats.pinned_bytes -= size;
+    registrations.erase(registration);
+
+    unpin(va, size);
+}
+
+void DmaRegistrationCache::enforce_budget()
+{
+    auto it = registrations.end();
+    while (stats.pinned_bytes > budget && it != registrations.begin()) {
+        --it;
+        if (it->refs == 0) {
+            auto victim = it++;
+            remove(victim);
+        }
+    }
+}
+
+} // namespace tt
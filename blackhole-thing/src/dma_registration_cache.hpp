@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace tt {
+
+/**
+ * @brief Counters for the DMA registration cache.
+ *
+ * hits:         map requests covered by an existing pinned range
+ * misses:       map requests that had to pin
+ * unpins:       ranges unpinned (final unmaps, budget pressure, merges, flushes)
+ * pinned_bytes: currently pinned, busy or idle
+ */
+struct DmaCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t unpins;
+    uint64_t pinned_bytes;
+};
+
+/**
+ * @brief Shares pins between overlapping map requests and, if asked to,
+ * keeps host buffers pinned after the caller is done with them, so that
+ * mapping the same buffer again is a lookup instead of an ioctl.
+ *
+ * Same idea as an RDMA memory registration cache.  Each registration is a
+ * pinned (va, size) range with a reference count.  A map request that falls
+ * entirely within an existing registration takes a reference on it.  A
+ * request that only partially overlaps absorbs any idle registrations it
+ * touches: they are unpinned and one range covering the union is pinned in
+ * their place.  Busy registrations are never touched, so registrations may
+ * overlap each other.
+ *
+ * Registrations are indexed by start address; the overlap search starts at
+ * (va - largest registration size), which bounds the scan the same way an
+ * interval tree's max-end augmentation would.
+ *
+ * By default a registration is unpinned as soon as its last reference is
+ * dropped.  The cache can't tell when memory is freed, and a registration
+ * left pinned past free() would hand the next allocation at the same address
+ * an IOVA for the old physical pages.  With set_retain_idle(true), idle
+ * registrations stay pinned until the pinned total exceeds the budget, at
+ * which point they are unpinned least recently used first; the caller then
+ * promises to invalidate() memory before freeing it.  If every registration
+ * is busy, the budget is exceeded rather than failing the map.
+ */
+class DmaRegistrationCache
+{
+public:
+    using PinFn = std::function<uint64_t(uint64_t va, size_t size)>;
+    using UnpinFn = std::function<void(uint64_t va, size_t size)>;
+
+    /**
+     * @param pin pins (va, size) and returns its IOVA
+     * @param unpin unpins a range previously given to pin
+     */
+    DmaRegistrationCache(PinFn pin, UnpinFn unpin);
+
+    /**
+     * @brief Pin (or find already pinned) memory and take a reference.
+     *
+     * @return IOVA corresponding to va
+     */
+    uint64_t map(uint64_t va, size_t size);
+
+    /**
+     * @brief Drop a reference taken by map().
+     *
+     * @param iova any IOVA returned by map()
+     */
+    void unmap(uint64_t iova);
+
+    /**
+     * @brief Keep registrations pinned after their last unmap.
+     *
+     * Only safe if every range is passed to invalidate() before it is freed.
+     * Turning this off unpins every idle registration.  Default is off.
+     */
+    void set_retain_idle(bool retain);
+
+    /**
+     * @brief Limit on pinned bytes; idle registrations are unpinned to stay
+     * under it.  Default is unlimited.
+     */
+    void set_budget(size_t bytes);
+
+    /**
+     * @brief Unpin every idle registration.
+     */
+    void flush();
+
+    /**
+     * @brief Forget about a range of memory that is about to be freed.
+     *
+     * Idle registrations overlapping the range are unpinned.  Without this, a
+     * later allocation that reuses the virtual addresses would hit in the
+     * cache and get an IOVA for the old physical pages.
+     *
+     * @throws std::runtime_error if a registration overlapping the range is
+     * still busy
+     */
+    void invalidate(uint64_t va, size_t size);
+
+    DmaCacheStats get_stats();
+
+private:
+    struct Registration
+    {
+        uint64_t va;
+        size_t size;
+        uint64_t iova;
+        size_t refs;
+    };
+    using Iterator = std::list<Registration>::iterator;
+
+    std::vector<Iterator> overlapping(uint64_t va, size_t size);
+    void remove(Iterator registration);
+    void enforce_budget();
+
+    const PinFn pin;
+    const UnpinFn unpin;
+
+    std::mutex mutex;
+    std::list<Registration> registrations; // most recently used at the front
+    std::multimap<uint64_t, Iterator> by_va;
+    std::multimap<uint64_t, Iterator> by_iova;
+    size_t largest = 0;
+    size_t budget = SIZE_MAX;
+    bool retain_idle = false;
+    DmaCacheStats stats{};
+};
+
+} // namespace tt
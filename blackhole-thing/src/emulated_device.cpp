@@ -0,0 +1,102 @@
+#include "emulated_device.hpp"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <system_error>
+
+namespace tt {
+
+static uint8_t* map_anonymous(size_t size)
+{
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category(), "Failed to map emulated BAR");
+    }
+    return static_cast<uint8_t*>(p);
+}
+
+EmulatedDevice::EmulatedDevice(size_t bar0_size, size_t bar2_size, size_t bar4_size)
+    : bar0_size(bar0_size)
+    , bar2_size(bar2_size)
+    , bar4_size(bar4_size)
+    , bar0(map_anonymous(bar0_size))
+    , bar2(map_anonymous(bar2_size))
+    , bar4(map_anonymous(bar4_size))
+    , memfd(memfd_create("blackhole-emulated", MFD_CLOEXEC))
+{
+    if (memfd < 0) {
+        throw std::system_error(errno, std::system_category(), "memfd_create failed");
+    }
+}
+
+EmulatedDevice::~EmulatedDevice()
+{
+    munmap(bar0, bar0_size);
+    munmap(bar2, bar2_size);
+    munmap(bar4, bar4_size);
+    close(memfd);
+}
+
+PciDeviceInfo EmulatedDevice::get_info() const
+{
+    return PciDeviceInfo{0x1e52, 0xb140, 0, 0, 0, 0};
+}
+
+void EmulatedDevice::retarget(uint8_t* window, size_t size, uint32_t x, uint32_t y, uint64_t address)
+{
+    uint64_t offset;
+    {
+        std::scoped_lock lock(mutex);
+        offset = slot_offset(x, y, address) + (address & (SLOT_SIZE - 1));
+    }
+
+    void* p = mmap(window, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, memfd, offset);
+    if (p == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category(), "Failed to retarget emulated window");
+    }
+}
+
+uint64_t EmulatedDevice::pin_pages(uint64_t va, size_t)
+{
+    return va;
+}
+
+void EmulatedDevice::unpin_pages(uint64_t, size_t)
+{
+}
+
+DriverDmaBuffer EmulatedDevice::allocate_dma_buffer(size_t size)
+{
+    size = (size + 0xFFF) & ~size_t(0xFFF);
+    uint8_t* memory = map_anonymous(size);
+    return DriverDmaBuffer{memory, reinterpret_cast<uint64_t>(memory), size};
+}
+
+size_t EmulatedDevice::num_backing_slots()
+{
+    std::scoped_lock lock(mutex);
+    return slots.size();
+}
+
+uint64_t EmulatedDevice::slot_offset(uint32_t x, uint32_t y, uint64_t address)
+{
+    // 6 bits each of x and y, like the TLB config, leaves 52 for the page.
+    const uint64_t key = (uint64_t(x) << 58) | (uint64_t(y) << 52) | (address >> 32);
+
+    auto it = slots.find(key);
+    if (it != slots.end()) {
+        return it->second;
+    }
+
+    const uint64_t offset = slots.size() * SLOT_SIZE;
+    if (ftruncate(memfd, offset + SLOT_SIZE) != 0) {
+        throw std::system_error(errno, std::system_category(), "Failed to grow emulated device memory");
+    }
+
+    slots.emplace(key, offset);
+    return offset;
+}
+
+} // namespace tt
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "blackhole_pcie.hpp"
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace tt {
+
+/**
+ * @brief In-process stand-in for the hardware behind BlackholePciDevice.
+ *
+ * Lets the library's allocation, bookkeeping and copy paths run on a machine
+ * with no Blackhole in it.  Not a simulator: nothing on the chip runs, and
+ * timings are those of host memory plus an mmap() per TLB reprogram.
+ *
+ * The BARs are anonymous memory, so register writes (TLB configuration,
+ * DBI/iATU in BAR2, everything else in BAR0) read back as written.
+ *
+ * Device memory is one sparse memfd.  Each (x, y, 4 GiB-aligned address) the
+ * program touches gets a 4 GiB slot in it; pages are only allocated when
+ * written.  When a TLB window is (re)programmed, BlackholePciDevice calls
+ * retarget(), which maps the relevant part of that slot over the window with
+ * MAP_FIXED.  Every window pointed at the same NOC address therefore sees the
+ * same memory, whether it is 2 MiB or 4 GiB, WC or UC.
+ *
+ * Multicast windows only reach their end corner.  Pinning returns the virtual
+ * address as the IOVA; nothing on the "device" ever reads host memory.
+ */
+class EmulatedDevice
+{
+public:
+    EmulatedDevice(size_t bar0_size, size_t bar2_size, size_t bar4_size);
+    ~EmulatedDevice();
+
+    EmulatedDevice(const EmulatedDevice&) = delete;
+    EmulatedDevice& operator=(const EmulatedDevice&) = delete;
+
+    PciDeviceInfo get_info() const;
+
+    uint8_t* get_bar0() { return bar0; }
+    uint8_t* get_bar2() { return bar2; }
+    uint8_t* get_bar4() { return bar4; }
+
+    /**
+     * @brief Point a window at the backing store for (x, y, address).
+     *
+     * @param window start of the window in BAR0 or BAR4
+     * @param size of the window; address must be aligned to it
+     */
+    void retarget(uint8_t* window, size_t size, uint32_t x, uint32_t y, uint64_t address);
+
+    uint64_t pin_pages(uint64_t va, size_t size);
+    void unpin_pages(uint64_t va, size_t size);
+
+    /**
+     * @brief What TT-KMD's ALLOCATE_DMA_BUF would give us.  The caller owns
+     * the mapping and munmap()s it.
+     */
+    DriverDmaBuffer allocate_dma_buffer(size_t size);
+
+    /**
+     * @brief Distinct (x, y, 4 GiB page) regions touched so far.
+     */
+    size_t num_backing_slots();
+
+private:
+    static constexpr uint64_t SLOT_SIZE = 1ULL << 32;
+
+    uint64_t slot_offset(uint32_t x, uint32_t y, uint64_t address); // caller holds mutex
+
+    const size_t bar0_size;
+    const size_t bar2_size;
+    const size_t bar4_size;
+
+    uint8_t* bar0;
+    uint8_t* bar2;
+    uint8_t* bar4;
+
+    int memfd;
+    std::mutex mutex;
+    std::unordered_map<uint64_t, uint64_t> slots; // (x, y, address >> 32) -> memfd offset
+};
+
+} // namespace tt
@@ -0,0 +1,137 @@
+#include "iatu_region_manager.hpp"
+
+#include "async_dma_pin.hpp"
+#include "blackhole_pcie.hpp"
+
+#include <stdexcept>
+
+namespace tt {
+
+static bool aligned(uint64_t value)
+{
+    return (value & (IatuRegionManager::REGION_ALIGNMENT - 1)) == 0;
+}
+
+IatuRegionManager::IatuRegionManager(BlackholePciDevice& device, uint64_t base, uint64_t size)
+    : device(device)
+    , space_base(base)
+    , space_size(size)
+    , region_used(NUM_REGIONS, false)
+{
+    if (!aligned(base) || !aligned(size) || size == 0) {
+        throw std::invalid_argument("iATU address space must be 4 KiB-aligned and non-empty");
+    }
+}
+
+std::unique_ptr<IatuMapping> IatuRegionManager::map(const std::vector<IovaExtent>& extents)
+{
+    if (extents.empty()) {
+        throw std::invalid_argument("Nothing to map through the iATU");
+    }
+
+    // One region per run of IOVA-adjacent extents.
+    std::vector<IovaExtent> merged;
+    size_t total = 0;
+    for (const auto& extent : extents) {
+        if (extent.size == 0 || !aligned(extent.iova) || !aligned(extent.size)) {
+            throw std::invalid_argument("IOVA extent is empty or not 4 KiB-aligned");
+        }
+        if (!merged.empty() && merged.back().iova + merged.back().size == extent.iova) {
+            merged.back().size += extent.size;
+        } else {
+            merged.push_back(extent);
+        }
+        total += extent.size;
+    }
+
+    std::scoped_lock lock(mutex);
+
+    auto it = mappings.find(merged);
+    if (it == mappings.end()) {
+        std::vector<size_t> regions;
+        for (size_t i = 0; i < NUM_REGIONS && regions.size() < merged.size(); ++i) {
+            if (!region_used[i]) {
+                regions.push_back(i);
+            }
+        }
+        if (regions.size() < merged.size()) {
+            throw std::runtime_error("Not enough free iATU regions");
+        }
+
+        const uint64_t device_address = allocate_range(total);
+
+        uint64_t base = device_address;
+        for (size_t i = 0; i < merged.size(); ++i) {
+            device.configure_iatu_region(regions[i], base, merged[i].iova, merged[i].size);
+            region_used[regions[i]] = true;
+            base += merged[i].size;
+        }
+
+        it = mappings.emplace(merged, Mapping{device_address, total, std::move(regions), 0}).first;
+    }
+
+    Mapping& mapping = it->second;
+    mapping.refs++;
+    return std::make_unique<IatuMapping>(mapping.device_address, mapping.size, mapping.regions.size(),
+                                         [this, merged]() { release(merged); });
+}
+
+std::unique_ptr<IatuMapping> IatuRegionManager::map(AsyncDmaPin& pin)
+{
+    pin.wait();
+
+    std::vector<IovaExtent> extents;
+    for (const auto& chunk : pin.chunks()) {
+        extents.push_back({chunk.iova, chunk.size});
+    }
+    return map(extents);
+}
+
+size_t IatuRegionManager::free_regions()
+{
+    std::scoped_lock lock(mutex);
+
+    size_t count = 0;
+    for (bool used : region_used) {
+        count += used ? 0 : 1;
+    }
+    return count;
+}
+
+void IatuRegionManager::release(const std::vector<IovaExtent>& key)
+{
+    std::scoped_lock lock(mutex);
+
+    auto it = mappings.find(key);
+    if (it == mappings.end() || --it->second.refs > 0) {
+        return;
+    }
+
+    for (size_t region : it->second.regions) {
+        device.disable_iatu_region(region);
+        region_used[region] = false;
+    }
+    ranges.erase(it->second.device_address);
+    mappings.erase(it);
+}
+
+uint64_t IatuRegionManager::allocate_range(size_t size)
+{
+    // First fit.  There are at most NUM_REGIONS ranges, so a walk is fine.
+    uint64_t candidate = space_base;
+    for (const auto& [start, length] : ranges) {
+        if (start - candidate >= size) {
+            break;
+        }
+        candidate = start + length;
+    }
+
+    if (candidate - space_base > space_size || space_size - (candidate - space_base) < size) {
+        throw std::runtime_error("No free range of iATU address space is large enough");
+    }
+
+    ranges.emplace(candidate, size);
+    return candidate;
+}
+
+} // namespace tt
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "resource_handle.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace tt {
+
+class AsyncDmaPin;
+class BlackholePciDevice;
+
+/**
+ * @brief A device-visible (pinned) piece of host memory.
+ */
+struct IovaExtent
+{
+    uint64_t iova;
+    size_t size;
+
+    bool operator<(const IovaExtent& other) const
+    {
+        return iova != other.iova ? iova < other.iova : size < other.size;
+    }
+};
+
+/**
+ * @brief A set of extents laid out back to back in the PCIe core's outbound
+ * address space.  Unmapped when the last handle for it goes away.
+ */
+class IatuMapping : ReleaseOnDestroy
+{
+    const uint64_t device_address;
+    const size_t mapping_size;
+    const size_t num_regions;
+
+public:
+    IatuMapping(uint64_t device_address, size_t size, size_t num_regions, std::function<void()> release)
+        : ReleaseOnDestroy(std::move(release))
+        , device_address(device_address)
+        , mapping_size(size)
+        , num_regions(num_regions)
+    {
+    }
+
+    /**
+     * @brief Where the first extent starts, in the outbound address space.
+     *
+     * Add this to the base of a non-bypass outbound NOC TLB entry (e.g.
+     * PCIeCore::IATU_TLB_INDEX << 58) to get a NOC address for it.
+     */
+    uint64_t get_device_address() const { return device_address; }
+    size_t size() const { return mapping_size; }
+    size_t get_num_regions() const { return num_regions; }
+};
+
+/**
+ * @brief Hands out the 16 outbound iATU regions so a fragmented set of
+ * pinned host extents looks like one contiguous range to the device.
+ *
+ * configure_iatu_region maps one contiguous IOVA range, which means one
+ * giant pin.  This takes a list of extents (e.g. AsyncDmaPin's chunks),
+ * merges the ones that happen to be adjacent in IOVA space, picks a free
+ * range of the outbound address space for their total size, and programs
+ * one region per extent, back to back.
+ *
+ * Mapping the same extents again shares the existing regions and takes a
+ * reference; the regions are disabled and returned to the pool when the last
+ * IatuMapping for them is destroyed.  Nothing is printed; use
+ * BlackholePciDevice::dump_iatu_region to look at the hardware.
+ *
+ * Owns every region on the device, so make one per device, and keep it alive
+ * longer than the mappings it returns.
+ */
+class IatuRegionManager
+{
+public:
+    static constexpr size_t NUM_REGIONS = 16;
+
+    // iATU granule: base, target and size of a region are multiples of this.
+    static constexpr uint64_t REGION_ALIGNMENT = 4096;
+
+    /**
+     * @param base start of the outbound address space to allocate from,
+     * 4 KiB-aligned
+     * @param size its length, 4 KiB-aligned; the default covers one 2^58 outbound window
+     */
+    IatuRegionManager(BlackholePciDevice& device, uint64_t base = 0, uint64_t size = 1ULL << 58);
+
+    IatuRegionManager(const IatuRegionManager&) = delete;
+    IatuRegionManager& operator=(const IatuRegionManager&) = delete;
+
+    /**
+     * @param extents in the order they should appear; each 4 KiB-aligned
+     * @throws std::invalid_argument on an empty list or misaligned extent
+     * @throws std::runtime_error when there are not enough free regions or
+     * no free range of the address space is large enough
+     */
+    std::unique_ptr<IatuMapping> map(const std::vector<IovaExtent>& extents);
+
+    /**
+     * @brief Waits for pin to finish, then maps its chunks in buffer order.
+     */
+    std::unique_ptr<IatuMapping> map(AsyncDmaPin& pin);
+
+    size_t free_regions();
+
+private:
+    struct Mapping
+    {
+        uint64_t device_address;
+        size_t size;
+        std::vector<size_t> regions;
+        size_t refs;
+    };
+
+    void release(const std::vector<IovaExtent>& key);
+    uint64_t allocate_range(size_t size); // caller holds the mutex
+
+    BlackholePciDevice& device;
+    const uint64_t space_base;
+    const uint64_t space_size;
+
+    std::mutex mutex;
+    std::vector<bool> region_used;
+    std::map<std::vector<IovaExtent>, Mapping> mappings;
+    std::map<uint64_t, size_t> ranges; // device address -> size, in use
+};
+
+} // namespace tt
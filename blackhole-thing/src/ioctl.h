@@ -21,6 +21,7 @@
 #define TENSTORRENT_IOCTL_PIN_PAGES		_IO(TENSTORRENT_IOCTL_MAGIC, 7)
 #define TENSTORRENT_IOCTL_LOCK_CTL		_IO(TENSTORRENT_IOCTL_MAGIC, 8)
 #define TENSTORRENT_IOCTL_MAP_PEER_BAR		_IO(TENSTORRENT_IOCTL_MAGIC, 9)
+#define TENSTORRENT_IOCTL_UNPIN_PAGES		_IO(TENSTORRENT_IOCTL_MAGIC, 10)
 
 // For tenstorrent_mapping.mapping_id. These are not array indices.
 #define TENSTORRENT_MAPPING_UNUSED		0
@@ -160,6 +161,20 @@ struct tenstorrent_pin_pages {
 	struct tenstorrent_pin_pages_out out;
 };
 
+struct tenstorrent_unpin_pages_in {
+	__u64 virtual_address;
+	__u64 size;
+	__u64 reserved;
+};
+
+struct tenstorrent_unpin_pages_out {
+};
+
+struct tenstorrent_unpin_pages {
+	struct tenstorrent_unpin_pages_in in;
+	struct tenstorrent_unpin_pages_out out;
+};
+
 // tenstorrent_lock_ctl_in.flags
 #define TENSTORRENT_LOCK_CTL_ACQUIRE 0
 #define TENSTORRENT_LOCK_CTL_RELEASE 1
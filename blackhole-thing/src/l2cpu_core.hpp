@@ -2,10 +2,19 @@
 
 #include "atomic.hpp"
 #include "blackhole_pcie.hpp"
+#include "register_aperture.hpp"
+#include "resource_handle.hpp"
+#include "staging_ring.hpp"
+#include "tlb_entry_allocator.hpp"
 #include "tlb_window.hpp"
 
 #include <fmt/core.h>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 namespace tt {
 
@@ -148,6 +157,56 @@ typedef union {
 
 } // namespace l2cpu
 
+/**
+ * @brief How a host mapping of X280 DRAM relates to the X280's caches.
+ *
+ * Coherent goes through the memory port: NOC reads see lines the X280 has
+ * dirty in cache, and NOC writes invalidate its copies.  NonCoherent goes
+ * through the system port, straight to DRAM, skipping all that.  Data shared
+ * through a NonCoherent mapping needs the X280's caches flushed: after the
+ * X280 writes and before the host reads, and before the host writes anything
+ * the X280 may already have cached.  L2CPU::flush_dram is meant to do that
+ * but has not been checked on hardware yet; see there.
+ */
+enum class X280Access
+{
+    Coherent,
+    NonCoherent,
+};
+
+/**
+ * @brief A NOC TLB in an L2CPU, from L2CPU::map_noc_tlb_2M/128G.
+ *
+ * Destroying it releases the TLB entry back to the allocator.
+ */
+class L2CpuNocWindow : ReleaseOnDestroy
+{
+    const uint64_t x280_address;
+    const size_t window_size;
+    const size_t tlb_index;
+
+public:
+    L2CpuNocWindow(uint64_t x280_address, size_t size, size_t tlb_index, std::function<void()> release)
+        : ReleaseOnDestroy(std::move(release))
+        , x280_address(x280_address)
+        , window_size(size)
+        , tlb_index(tlb_index)
+    {
+    }
+
+    /**
+     * @brief Where the requested NOC address appears to the X280.
+     */
+    uint64_t get_x280_address() const { return x280_address; }
+
+    /**
+     * @brief Bytes from get_x280_address() to the end of the window.
+     */
+    size_t size() const { return window_size; }
+
+    size_t get_tlb_index() const { return tlb_index; }
+};
+
 /**
  * @brief One L2CPU core in Blackhole.
  *
@@ -158,10 +217,8 @@ typedef union {
  * The only L2CPU I've bothered with is the one at NOC0 (x=8, y=3).
  *
  * System port and Memory port are the same with one key difference: NOC access
- * to the memory port is coherent with X280 cache.  System port is not.
- *
- * TODO: I've just been changing the access address calculation back and forth
- * in the NOC TLB configuration functions.  If this were real code...
+ * to the memory port is coherent with X280 cache.  System port is not.  Host
+ * mappings of X280 DRAM pick one with X280Access; see map_dram_2M_WC etc.
  */
 class L2CPU
 {
@@ -174,72 +231,222 @@ class L2CPU
     static constexpr uint64_t L2CPU_REGISTERS   = 0xFFFF'F7FE'FFF0'0000ULL; // 512 KiB
     static constexpr uint64_t L2CPU_DMAC        = 0xFFFF'F7FE'FFF8'0000ULL;
     static constexpr uint64_t L2CPU_PREFETCH    = 0x02030000;
+
+    // SiFive cache controller.  Writing a physical address to Flush64 writes
+    // back and invalidates the line holding it, in every level of X280 cache.
+    static constexpr uint64_t L2CPU_CACHE_CTRL  = 0x0201'0000;
+    static constexpr uint64_t CACHE_FLUSH64     = 0x200;
+    static constexpr uint64_t CACHE_LINE_SIZE   = 64;
+
+    // Where DRAM appears in X280 physical address space (X280_DDR_BASE in
+    // console and x280-net).
+    static constexpr uint64_t X280_DRAM_BASE    = 0x0000'4000'3000'0000ULL;
+
+    static constexpr size_t NUM_CORES           = 4;
+    static constexpr uint64_t PREFETCHER_STRIDE = 0x2000;
+
+    static constexpr size_t NUM_NOC_TLBS_2M     = 224;
+    static constexpr size_t NUM_NOC_TLBS_128G   = 32;
+    static constexpr uint64_t NOC_TLB_2M_BASE   = 0x0000'0020'3000'0000ULL;
+    static constexpr uint64_t NOC_TLB_128G_BASE = 0x0000'0804'3000'0000ULL;
+
+    // The X280 device tree puts pmem at the base of this 128 GiB window, and
+    // memory_for_x280 points it at host memory.  Never handed out.
+    static constexpr size_t X280_PMEM_NOC_TLB_128G = 0;
     // clang-format on
 
+    struct NocTlbs
+    {
+        TlbEntryAllocator tlb_2M{NUM_NOC_TLBS_2M};
+        TlbEntryAllocator tlb_128G{NUM_NOC_TLBS_128G};
+    };
+
     BlackholePciDevice& device;
     const uint32_t our_noc0_x;
     const uint32_t our_noc0_y;
 
+    RegisterAperture registers;
+    std::shared_ptr<NocTlbs> noc_tlbs;
+
 public:
+    /**
+     * @brief 2 MiB of X280 DRAM (offset from its base) that the benchmarks
+     * overwrite.  It sits below x280-net's buffers; the X280 OS must leave it
+     * alone.
+     */
+    static constexpr uint64_t BENCH_SCRATCH_OFFSET = 0x0000'ffc0'0000ULL;
+
     L2CPU(BlackholePciDevice& device, uint32_t noc0_x, uint32_t noc0_y)
         : device(device)
         , our_noc0_x(noc0_x)
         , our_noc0_y(noc0_y)
+        , registers(device, noc0_x, noc0_y)
+        , noc_tlbs(shared_noc_tlbs(device, noc0_x, noc0_y))
     {
     }
 
+    uint32_t get_noc0_x() const { return our_noc0_x; }
+    uint32_t get_noc0_y() const { return our_noc0_y; }
+
     uint32_t read32(uint64_t address)
     {
-        auto tlb = device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, address);
-        return tlb->read32(0);
+        return registers.read32(address);
     }
 
     void write32(uint64_t address, uint32_t value)
     {
-        auto tlb = device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, address);
-        tlb->write32(0, value);
+        registers.write32(address, value);
     }
 
+    /**
+     * @brief Apply register reads and writes in order, with one fence at the
+     * end; see RegisterAperture::apply.
+     *
+     * @param ops reads have their value filled in
+     */
+    void apply_register_ops(std::vector<RegisterOp>& ops)
+    {
+        registers.apply(ops);
+    }
 
-    // TODO: would be ideal to manage tlb_index internally instead of making the
-    // caller have to pick one.
-    uint64_t configure_noc_tlb_2M(size_t tlb_index, uint32_t noc_x, uint32_t noc_y, uint64_t address)
+    /**
+     * @brief UC window onto the DMA controller registers.
+     *
+     * @return std::unique_ptr<TlbWindow> must not outlive BlackholePciDevice!
+     */
+    std::unique_ptr<TlbWindow> map_dmac_registers()
     {
-        auto registers = device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, L2CPU_REGISTERS);
-        size_t tlb_config_offset = tlb_index * 0x10;
+        return device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, L2CPU_DMAC);
+    }
 
-        const size_t tlb_size = 1ULL << 21; // 2 MiB
-        const size_t tlb_mask = tlb_size - 1;
-        const uint64_t local_offset = address & tlb_mask;
-        const size_t apparent_size = tlb_size - local_offset;
+    /**
+     * @brief Host windows onto X280 DRAM.
+     *
+     * @param offset from the start of X280 DRAM
+     * @param access which port to go through; see X280Access
+     * @return std::unique_ptr<TlbWindow> must not outlive BlackholePciDevice!
+     */
+    std::unique_ptr<TlbWindow> map_dram_2M_WC(uint64_t offset, X280Access access = X280Access::Coherent)
+    {
+        return device.map_tlb_2M_WC(our_noc0_x, our_noc0_y, dram_port_address(offset, access));
+    }
 
-        l2cpu::Tlb2M tlb{};
-        tlb.address = address >> 21;
-        tlb.x_end = noc_x;
-        tlb.y_end = noc_y;
-        tlb.strict_order = 1;
+    std::unique_ptr<TlbWindow> map_dram_2M_UC(uint64_t offset, X280Access access = X280Access::Coherent)
+    {
+        return device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, dram_port_address(offset, access));
+    }
+
+    std::unique_ptr<TlbWindow> map_dram_4G(uint64_t offset, X280Access access = X280Access::Coherent)
+    {
+        return device.map_tlb_4G(our_noc0_x, our_noc0_y, dram_port_address(offset, access));
+    }
+
+    /**
+     * @brief Write back and invalidate the X280's cached copies of a range of
+     * its DRAM, for sharing data through X280Access::NonCoherent mappings.
+     *
+     * One 64-bit register write per 64-byte line, fenced once at each end,
+     * so this is only cheap for small ranges.  The X280 must not be writing
+     * the range meanwhile.
+     *
+     * UNVERIFIED: the L2CPU_CACHE_CTRL offset follows the SiFive composable
+     * cache layout and nobody has checked it on a Blackhole yet.  Only
+     * x280_port_bench calls this; don't rely on it for correctness until it
+     * has been checked.
+     *
+     * @param offset from the start of X280 DRAM
+     */
+    void flush_dram(uint64_t offset, size_t size)
+    {
+        const uint64_t flush64 = L2CPU_CACHE_CTRL + CACHE_FLUSH64;
+        auto window = device.map_tlb_2M_UC_cached(our_noc0_x, our_noc0_y, flush64);
+
+        const uint64_t first = (X280_DRAM_BASE + offset) & ~(CACHE_LINE_SIZE - 1);
+        const uint64_t end = X280_DRAM_BASE + offset + size;
 
         mfence();
-        registers->write32(tlb_config_offset + 0x0, tlb.data[0]);
-        registers->write32(tlb_config_offset + 0x4, tlb.data[1]);
-        registers->write32(tlb_config_offset + 0x8, tlb.data[2]);
-        registers->write32(tlb_config_offset + 0xC, tlb.data[3]);
+        for (uint64_t line = first; line < end; line += CACHE_LINE_SIZE) {
+            window->write64(0, line);
+        }
         mfence();
+    }
 
-        // Where in X280 address space the window begins:
-        return 0x0000'0020'3000'0000ULL + (0x200000 * tlb_index);
+    /**
+     * @brief Experimental: message ring for small, latency-critical
+     * host-to-X280 messages, placed in the L3 zero region.  Not yet tried on
+     * hardware.
+     *
+     * That region has no DRAM behind it: lines live only in L3, so the X280
+     * reads messages from cache instead of from DRAM.  The flip side is that
+     * an evicted line is gone.  Whatever runs on the X280 must keep enough L3
+     * ways allocated to the zero region to hold the ring, and the ring should
+     * stay small (the default is 16 KiB).
+     *
+     * Everything else in the 2 MiB region is left alone, so the X280 may use
+     * the rest of it for its own purposes.
+     *
+     * The X280 side signals that it has assigned L3 ways to the region by
+     * writing StagingRing::READY at its start; nothing is written until it
+     * has.
+     *
+     * @throws std::runtime_error if the X280 side has not marked the region
+     * ready
+     */
+    std::unique_ptr<StagingRing> create_l3_staging_ring(size_t slot_size = 256, size_t num_slots = 63)
+    {
+        auto uc = device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, L3_ZERO_START);
+        if (!StagingRing::consumer_ready(*uc)) {
+            throw std::runtime_error("L3 zero region has not been set up by the X280");
+        }
+        auto wc = device.map_tlb_2M_WC(our_noc0_x, our_noc0_y, L3_ZERO_START);
+        return std::make_unique<StagingRing>(std::move(wc), std::move(uc), slot_size, num_slots);
+    }
+
+    /**
+     * @brief As create_l3_staging_ring, but in X280 DRAM through the memory
+     * port like x280-net and console use.  For comparison, or for rings too
+     * big for L3.
+     *
+     * @param offset from the start of X280 DRAM; the ring must not cross a
+     *               2 MiB boundary
+     */
+    std::unique_ptr<StagingRing> create_dram_staging_ring(uint64_t offset, size_t slot_size = 256,
+                                                          size_t num_slots = 63)
+    {
+        auto wc = map_dram_2M_WC(offset);
+        auto uc = map_dram_2M_UC(offset);
+        return std::make_unique<StagingRing>(std::move(wc), std::move(uc), slot_size, num_slots);
+    }
+
+    /**
+     * @brief Point one of the X280's 2 MiB NOC TLBs at (noc_x, noc_y, address).
+     *
+     * The index is taken out of the map_noc_tlb_2M pool for good.  Prefer
+     * map_noc_tlb_2M unless the X280 side expects a particular window.
+     *
+     * @return where the window begins in X280 address space
+     */
+    uint64_t configure_noc_tlb_2M(size_t tlb_index, uint32_t noc_x, uint32_t noc_y, uint64_t address)
+    {
+        noc_tlbs->tlb_2M.reserve(tlb_index);
+        return program_noc_tlb_2M(tlb_index, noc_x, noc_y, address);
     }
 
     void print_noc_tlb_2M(size_t tlb_index)
     {
-        auto registers = device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, L2CPU_REGISTERS);
-        size_t tlb_config_offset = tlb_index * 0x10;
+        const uint64_t tlb_config = L2CPU_REGISTERS + (tlb_index * 0x10);
+        std::vector<RegisterOp> ops = {
+            RegisterOp::read(tlb_config + 0x0),
+            RegisterOp::read(tlb_config + 0x4),
+            RegisterOp::read(tlb_config + 0x8),
+            RegisterOp::read(tlb_config + 0xC),
+        };
+        apply_register_ops(ops);
 
         l2cpu::Tlb2M tlb{};
-        tlb.data[0] = registers->read32(tlb_config_offset + 0x0);
-        tlb.data[1] = registers->read32(tlb_config_offset + 0x4);
-        tlb.data[2] = registers->read32(tlb_config_offset + 0x8);
-        tlb.data[3] = registers->read32(tlb_config_offset + 0xC);
+        for (size_t i = 0; i < 4; ++i) {
+            tlb.data[i] = ops[i].value;
+        }
         uint64_t address = tlb.address << 21;
         uint64_t x = tlb.x_end;
         uint64_t y = tlb.y_end;
@@ -248,76 +455,150 @@ public:
 
     void print_noc_tlb_128G(size_t tlb_index)
     {
-        auto registers = device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, L2CPU_REGISTERS);
-        size_t tlb_config_offset = 0xE00 + (tlb_index * 0xC);
+        const uint64_t tlb_config = L2CPU_REGISTERS + 0xE00 + (tlb_index * 0xC);
+        std::vector<RegisterOp> ops = {
+            RegisterOp::read(tlb_config + 0x0),
+            RegisterOp::read(tlb_config + 0x4),
+            RegisterOp::read(tlb_config + 0x8),
+        };
+        apply_register_ops(ops);
 
         l2cpu::Tlb128G tlb{};
-        tlb.data[0] = registers->read32(tlb_config_offset + 0x0);
-        tlb.data[1] = registers->read32(tlb_config_offset + 0x4);
-        tlb.data[2] = registers->read32(tlb_config_offset + 0x8);
+        for (size_t i = 0; i < 3; ++i) {
+            tlb.data[i] = ops[i].value;
+        }
         uint64_t address = (size_t)tlb.address << 37ULL;
         uint64_t x = tlb.x_end;
         uint64_t y = tlb.y_end;
         fmt::print("{} addr: {:#x}, x: {}, y: {}\n", tlb_index, address, x, y);
     }
 
+    /**
+     * @brief As configure_noc_tlb_2M, for the 128 GiB NOC TLBs.
+     *
+     * @return X280 address corresponding to address
+     */
     uint64_t configure_noc_tlb_128G(size_t tlb_index, uint32_t noc_x, uint32_t noc_y, uint64_t address)
     {
-        auto registers = device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, L2CPU_REGISTERS);
-        size_t tlb_config_offset = 0xE00 + (tlb_index * 0xC);
+        noc_tlbs->tlb_128G.reserve(tlb_index);
+        return program_noc_tlb_128G(tlb_index, noc_x, noc_y, address);
+    }
 
-        const size_t tlb_size = 1ULL << 37; // 128 GiB
-        const size_t tlb_mask = tlb_size - 1;
-        const uint64_t local_offset = address & tlb_mask;
-        const size_t apparent_size = tlb_size - local_offset;
+    /**
+     * @brief Map (noc_x, noc_y, address) into X280 address space using a 2 MiB
+     * NOC TLB chosen by the allocator.
+     *
+     * If a window onto the same 2 MiB page is already programmed, in use or
+     * idle, it is shared rather than programming another.  The allocator is
+     * shared by every L2CPU object for this tile on this device, so separate
+     * parts of a program don't clobber each other's windows.  It does not
+     * know about other processes, nor about windows a running X280 kernel
+     * uses, apart from X280_PMEM_NOC_TLB_128G which is always reserved.  Don't
+     * use it on an L2CPU whose X280s are up unless you know which entries
+     * they rely on and have reserved them with configure_noc_tlb_*.
+     *
+     * @return handle; the window stays programmed (idle) after it is destroyed
+     * @throws std::runtime_error if all 224 are in use or reserved
+     */
+    std::unique_ptr<L2CpuNocWindow> map_noc_tlb_2M(uint32_t noc_x, uint32_t noc_y, uint64_t address)
+    {
+        const size_t tlb_size = 1ULL << 21;
+        const uint64_t local_offset = address & (tlb_size - 1);
+        const uint64_t key = noc_tlb_key(noc_x, noc_y, address >> 21);
 
-        l2cpu::Tlb128G tlb{};
-        tlb.address = address >> 37;
-        tlb.x_end = noc_x;
-        tlb.y_end = noc_y;
+        auto tlbs = noc_tlbs;
+        const size_t tlb_index = tlbs->tlb_2M.acquire(
+            key, [&](size_t index) { program_noc_tlb_2M(index, noc_x, noc_y, address); });
 
-        // HACK!
-        // tlb.strict_order = 1;
-        // tlb.posted = 1;
+        const uint64_t x280_address = NOC_TLB_2M_BASE + (tlb_size * tlb_index) + local_offset;
+        auto release = [tlbs, tlb_index]() { tlbs->tlb_2M.release(tlb_index); };
+        return std::make_unique<L2CpuNocWindow>(x280_address, tlb_size - local_offset, tlb_index, release);
+    }
 
-        mfence();
-        registers->write32(tlb_config_offset + 0x0, tlb.data[0]);
-        registers->write32(tlb_config_offset + 0x4, tlb.data[1]);
-        registers->write32(tlb_config_offset + 0x8, tlb.data[2]);
-        mfence();
+    /**
+     * @brief As map_noc_tlb_2M, for the 32 128 GiB NOC TLBs.
+     */
+    std::unique_ptr<L2CpuNocWindow> map_noc_tlb_128G(uint32_t noc_x, uint32_t noc_y, uint64_t address)
+    {
+        const size_t tlb_size = 1ULL << 37;
+        const uint64_t local_offset = address & (tlb_size - 1);
+        const uint64_t key = noc_tlb_key(noc_x, noc_y, address >> 37);
 
-        // Where in X280 space does the window begin?  L2CPU Spec.docx gave me
-        // numbers that did not work.
-        //
-        // Andrew says,
-        //  RTL uses bit 43 to determine whether to use 2MB TLBs (bit 43=0) or 128GB TLBs (bit 43=1)
-        //  the address is evaluated after passing ddr_noc_xbar which sends 0x2000000000+ to NOC
-        //  So I think the first 128GB TLB is at system_port_address + noc_address + bit 43 = 0x82030000000
-        //
-        // Maybe that's not right?!
-        // 0x0060_3000_0000
+        auto tlbs = noc_tlbs;
+        const size_t tlb_index = tlbs->tlb_128G.acquire(
+            key, [&](size_t index) { program_noc_tlb_128G(index, noc_x, noc_y, address); });
 
-        // auto access_address = 0x82030000000 + (0x2000000000 * tlb_index) + local_offset;
-        // auto access_address = ((1ULL << 43) | ((1ULL << 37) * (1 + tlb_index)) | SYSTEM_PORT) + local_offset;
-        auto access_address = 0x80430000000ULL + ((1ULL << 37) * tlb_index) + local_offset;
-        return access_address;
+        const uint64_t x280_address = NOC_TLB_128G_BASE + (tlb_size * tlb_index) + local_offset;
+        auto release = [tlbs, tlb_index]() { tlbs->tlb_128G.release(tlb_index); };
+        return std::make_unique<L2CpuNocWindow>(x280_address, tlb_size - local_offset, tlb_index, release);
     }
 
-    void configure_prefetcher(uint32_t prefetcher_ctrl0, uint32_t prefetcher_ctrl1)
+    TlbOccupancy get_noc_tlb_2M_occupancy() { return noc_tlbs->tlb_2M.occupancy(); }
+    TlbOccupancy get_noc_tlb_128G_occupancy() { return noc_tlbs->tlb_128G.occupancy(); }
+
+    /**
+     * @brief Program all four cores' prefetchers with the same settings,
+     * quietly.  configure_prefetcher does the same and prints what changed.
+     */
+    void set_prefetcher(uint32_t prefetcher_ctrl0, uint32_t prefetcher_ctrl1)
     {
-        std::vector<uint64_t> offsets = { 0x0000, 0x2000, 0x4000, 0x6000 };
-        for (auto offset : offsets) {
-            auto addr = L2CPU_PREFETCH + offset;
-            auto val = read32(addr);
+        std::vector<RegisterOp> writes;
+        for (size_t core = 0; core < NUM_CORES; ++core) {
+            auto addr = L2CPU_PREFETCH + (core * PREFETCHER_STRIDE);
+            writes.push_back(RegisterOp::write(addr, prefetcher_ctrl0));
+            writes.push_back(RegisterOp::write(addr + 0x4, prefetcher_ctrl1));
+        }
+        apply_register_ops(writes);
+    }
 
-            write32(addr, prefetcher_ctrl0);
-            fmt::print("Prefetcher at {:#x} configured: {:#x} -> {:#x}\n", addr, val, prefetcher_ctrl0);
+    /**
+     * @brief Program one core's prefetcher, quietly.
+     */
+    void set_prefetcher(size_t core, uint32_t prefetcher_ctrl0, uint32_t prefetcher_ctrl1)
+    {
+        auto addr = L2CPU_PREFETCH + (core * PREFETCHER_STRIDE);
+        std::vector<RegisterOp> writes = {
+            RegisterOp::write(addr, prefetcher_ctrl0),
+            RegisterOp::write(addr + 0x4, prefetcher_ctrl1),
+        };
+        apply_register_ops(writes);
+    }
 
-            addr += 0x4;
-            val = read32(addr);
-            write32(addr, prefetcher_ctrl1);
+    static constexpr size_t num_cores() { return NUM_CORES; }
 
-            fmt::print("Prefetcher at {:#x} configured: {:#x} -> {:#x}\n", addr, val, prefetcher_ctrl1);
+    /**
+     * @brief Read one core's prefetcher settings.
+     *
+     * @return {PrefetcherCtrl0, PrefetcherCtrl1}
+     */
+    std::pair<uint32_t, uint32_t> read_prefetcher(size_t core = 0)
+    {
+        auto addr = L2CPU_PREFETCH + (core * PREFETCHER_STRIDE);
+        std::vector<RegisterOp> reads = {
+            RegisterOp::read(addr),
+            RegisterOp::read(addr + 0x4),
+        };
+        apply_register_ops(reads);
+        return {reads[0].value, reads[1].value};
+    }
+
+    void configure_prefetcher(uint32_t prefetcher_ctrl0, uint32_t prefetcher_ctrl1)
+    {
+        // One pass to read the old values, one to write the new ones.
+        std::vector<RegisterOp> reads;
+        for (size_t core = 0; core < NUM_CORES; ++core) {
+            auto addr = L2CPU_PREFETCH + (core * PREFETCHER_STRIDE);
+            reads.push_back(RegisterOp::read(addr));
+            reads.push_back(RegisterOp::read(addr + 0x4));
+        }
+        apply_register_ops(reads);
+        set_prefetcher(prefetcher_ctrl0, prefetcher_ctrl1);
+
+        for (size_t i = 0; i < reads.size(); i += 2) {
+            fmt::print("Prefetcher at {:#x} configured: {:#x} -> {:#x}\n", reads[i].address, reads[i].value,
+                       prefetcher_ctrl0);
+            fmt::print("Prefetcher at {:#x} configured: {:#x} -> {:#x}\n", reads[i + 1].address, reads[i + 1].value,
+                       prefetcher_ctrl1);
 
             l2cpu::PrefetcherCtrl0 ctrl0;
             l2cpu::PrefetcherCtrl1 ctrl1;
@@ -355,6 +636,102 @@ public:
     {
         configure_prefetcher(0x15811, 0x38c84e);
     }
+
+private:
+    static uint64_t dram_port_address(uint64_t offset, X280Access access)
+    {
+        return (access == X280Access::Coherent ? MEMORY_PORT : SYSTEM_PORT) + offset;
+    }
+
+    static uint64_t noc_tlb_key(uint32_t noc_x, uint32_t noc_y, uint64_t page)
+    {
+        return (uint64_t(noc_x) << 58) | (uint64_t(noc_y) << 52) | page;
+    }
+
+    // One allocator pair per (device, tile), shared by every L2CPU object for
+    // that tile and kept alive by outstanding handles.  The X280's pmem window
+    // is never handed out.
+    static std::shared_ptr<NocTlbs> shared_noc_tlbs(BlackholePciDevice& device, uint32_t noc_x, uint32_t noc_y)
+    {
+        static PerTileRegistry<NocTlbs> registry;
+
+        return registry.get(device, noc_x, noc_y, [] {
+            auto tlbs = std::make_shared<NocTlbs>();
+            tlbs->tlb_128G.reserve(X280_PMEM_NOC_TLB_128G);
+            return tlbs;
+        });
+    }
+
+    uint64_t program_noc_tlb_2M(size_t tlb_index, uint32_t noc_x, uint32_t noc_y, uint64_t address)
+    {
+        const uint64_t tlb_config = L2CPU_REGISTERS + (tlb_index * 0x10);
+
+        const size_t tlb_size = 1ULL << 21; // 2 MiB
+        const size_t tlb_mask = tlb_size - 1;
+        const uint64_t local_offset = address & tlb_mask;
+        const size_t apparent_size = tlb_size - local_offset;
+
+        l2cpu::Tlb2M tlb{};
+        tlb.address = address >> 21;
+        tlb.x_end = noc_x;
+        tlb.y_end = noc_y;
+        tlb.strict_order = 1;
+
+        std::vector<RegisterOp> ops = {
+            RegisterOp::write(tlb_config + 0x0, tlb.data[0]),
+            RegisterOp::write(tlb_config + 0x4, tlb.data[1]),
+            RegisterOp::write(tlb_config + 0x8, tlb.data[2]),
+            RegisterOp::write(tlb_config + 0xC, tlb.data[3]),
+        };
+        mfence();
+        apply_register_ops(ops);
+
+        // Where in X280 address space the window begins:
+        return NOC_TLB_2M_BASE + (tlb_size * tlb_index);
+    }
+
+    uint64_t program_noc_tlb_128G(size_t tlb_index, uint32_t noc_x, uint32_t noc_y, uint64_t address)
+    {
+        const uint64_t tlb_config = L2CPU_REGISTERS + 0xE00 + (tlb_index * 0xC);
+
+        const size_t tlb_size = 1ULL << 37; // 128 GiB
+        const size_t tlb_mask = tlb_size - 1;
+        const uint64_t local_offset = address & tlb_mask;
+        const size_t apparent_size = tlb_size - local_offset;
+
+        l2cpu::Tlb128G tlb{};
+        tlb.address = address >> 37;
+        tlb.x_end = noc_x;
+        tlb.y_end = noc_y;
+
+        // HACK!
+        // tlb.strict_order = 1;
+        // tlb.posted = 1;
+
+        std::vector<RegisterOp> ops = {
+            RegisterOp::write(tlb_config + 0x0, tlb.data[0]),
+            RegisterOp::write(tlb_config + 0x4, tlb.data[1]),
+            RegisterOp::write(tlb_config + 0x8, tlb.data[2]),
+        };
+        mfence();
+        apply_register_ops(ops);
+
+        // Where in X280 space does the window begin?  L2CPU Spec.docx gave me
+        // numbers that did not work.
+        //
+        // Andrew says,
+        //  RTL uses bit 43 to determine whether to use 2MB TLBs (bit 43=0) or 128GB TLBs (bit 43=1)
+        //  the address is evaluated after passing ddr_noc_xbar which sends 0x2000000000+ to NOC
+        //  So I think the first 128GB TLB is at system_port_address + noc_address + bit 43 = 0x82030000000
+        //
+        // Maybe that's not right?!
+        // 0x0060_3000_0000
+
+        // auto access_address = 0x82030000000 + (0x2000000000 * tlb_index) + local_offset;
+        // auto access_address = ((1ULL << 43) | ((1ULL << 37) * (1 + tlb_index)) | SYSTEM_PORT) + local_offset;
+        auto access_address = NOC_TLB_128G_BASE + (tlb_size * tlb_index) + local_offset;
+        return access_address;
+    }
 };
 
 } // namespace tt
\ No newline at end of file
@@ -0,0 +1,295 @@
+#pragma once
+
+#include "atomic.hpp"
+#include "l2cpu_core.hpp"
+#include "tlb_window.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+namespace tt {
+
+/**
+ * @brief Bulk copy engine built on the L2CPU DMA controller.
+ *
+ * The host programs the DMAC through a UC window and the DMAC moves the data,
+ * so host cores are free while a copy runs.  For device-to-host traffic the
+ * data arrives as posted PCIe writes from the device instead of the host
+ * issuing non-posted MMIO reads, which is a lot faster.
+ *
+ * Addresses are in X280 physical address space.  To reach something other
+ * than the X280's own DRAM, map it into X280 space first:
+ *
+ *  - another NOC endpoint: L2CPU::map_noc_tlb_2M/128G
+ *  - pinned host memory: BlackholePciDevice::map_for_dma for the IOVA,
+ *    PCIeCore::map_outbound for the NOC address of the IOVA, then
+ *    L2CPU::map_noc_tlb_128G pointing at the PCIe core
+ *
+ * The register layout here is that of the SiFive PDMA (four channels, 0x1000
+ * apart, Next* registers staged and copied to Exec* on run).  That is what
+ * the Linux sf-pdma driver programs.  I have not found an X280-specific
+ * document that says otherwise.
+ *
+ * Needs the DMAC to itself.  Claiming a channel is a plain register write,
+ * not a test-and-set, so nothing stops sf-pdma on the X280 from claiming the
+ * same channel at the same moment.  Channels that are visibly claimed are
+ * skipped and a claim that reads back as someone else's run is given up,
+ * but that only catches the obvious collisions: don't use this while Linux
+ * on that L2CPU has the DMAC.
+ */
+class L2CpuDma
+{
+    static constexpr size_t NUM_CHANNELS = 4;
+    static constexpr uint64_t CHANNEL_STRIDE = 0x1000;
+
+    // clang-format off
+    static constexpr uint64_t CONTROL           = 0x000;
+    static constexpr uint64_t NEXT_CONFIG       = 0x004;
+    static constexpr uint64_t NEXT_BYTES        = 0x008;
+    static constexpr uint64_t NEXT_DESTINATION  = 0x010;
+    static constexpr uint64_t NEXT_SOURCE       = 0x018;
+
+    static constexpr uint32_t CONTROL_CLAIM     = 1u << 0;
+    static constexpr uint32_t CONTROL_RUN       = 1u << 1;
+    static constexpr uint32_t CONTROL_DONE      = 1u << 30;
+    static constexpr uint32_t CONTROL_ERROR     = 1u << 31;
+
+    // wsize = rsize = 0xF: largest transactions the hardware supports.
+    // order = 1: don't let the DMAC reorder its own accesses.
+    static constexpr uint32_t CONFIG_FULL_SPEED = 0xFF00'0008;
+    // clang-format on
+
+    // Failed tickets nobody has cleared yet.  Past this many the oldest are
+    // forgotten; see poll().
+    static constexpr size_t MAX_TRACKED_FAILURES = 64;
+
+    std::unique_ptr<TlbWindow> registers;
+    std::mutex mutex;
+    uint64_t next_ticket = 1;
+    std::array<std::optional<uint64_t>, NUM_CHANNELS> in_flight{};
+    std::deque<uint64_t> failed;
+    uint64_t forgotten_through = 0;
+
+public:
+    /**
+     * @brief A submitted copy.  Tickets are never reused.
+     */
+    using Ticket = uint64_t;
+
+    /**
+     * @param l2cpu whose DMAC to drive; the engine keeps a window open on it
+     */
+    L2CpuDma(L2CPU& l2cpu)
+        : registers(l2cpu.map_dmac_registers())
+    {
+    }
+
+    ~L2CpuDma()
+    {
+        wait_all();
+    }
+
+    size_t num_channels() const
+    {
+        return NUM_CHANNELS;
+    }
+
+    /**
+     * @brief Start a copy on an idle channel.
+     *
+     * A channel is idle if this engine has nothing running on it and it isn't
+     * claimed.  If there is no idle channel, waits for one.
+     *
+     * @param dst X280 physical address
+     * @param src X280 physical address
+     * @param size in bytes
+     * @return ticket for poll() / wait()
+     * @throws std::runtime_error if no channel becomes idle within timeout,
+     * or if the channel turns out to be running for someone else
+     */
+    Ticket submit(uint64_t dst, uint64_t src, uint64_t size,
+                  std::chrono::milliseconds timeout = std::chrono::seconds(10))
+    {
+        std::unique_lock lock(mutex);
+        std::optional<size_t> channel;
+
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!(channel = idle_channel())) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                throw std::runtime_error("L2CPU DMA: no idle channel");
+            }
+            reap_completed();
+        }
+
+        const uint64_t base = *channel * CHANNEL_STRIDE;
+        registers->write32(base + CONTROL, CONTROL_CLAIM);
+        if (registers->read32(base + CONTROL) & (CONTROL_RUN | CONTROL_DONE | CONTROL_ERROR)) {
+            // Someone claimed it between idle_channel() and here.  Leave it.
+            throw std::runtime_error("L2CPU DMA: channel in use by another driver");
+        }
+        registers->write32(base + NEXT_CONFIG, CONFIG_FULL_SPEED);
+        write64(base + NEXT_BYTES, size);
+        write64(base + NEXT_DESTINATION, dst);
+        write64(base + NEXT_SOURCE, src);
+        mfence();
+        registers->write32(base + CONTROL, CONTROL_CLAIM | CONTROL_RUN);
+
+        const Ticket ticket = next_ticket++;
+        in_flight[*channel] = ticket;
+        return ticket;
+    }
+
+    /**
+     * @brief Has the copy finished?
+     *
+     * A failed copy keeps throwing until clear_error() is called for it.
+     * Only the last MAX_TRACKED_FAILURES uncleared failures are remembered.
+     * A ticket old enough that its failure may have been forgotten can't be
+     * reported as a success, so polling it throws.
+     *
+     * @throws std::invalid_argument if the ticket was never issued
+     * @throws std::runtime_error if the DMAC reported an error for it, or if
+     * its outcome is no longer known
+     */
+    bool poll(Ticket ticket)
+    {
+        std::unique_lock lock(mutex);
+        check_issued(ticket);
+        reap_completed();
+
+        if (std::find(failed.begin(), failed.end(), ticket) != failed.end()) {
+            throw std::runtime_error("L2CPU DMA error");
+        }
+
+        for (const auto& t : in_flight) {
+            if (t == ticket) {
+                return false;
+            }
+        }
+
+        if (ticket <= forgotten_through) {
+            throw std::runtime_error("L2CPU DMA: outcome no longer tracked");
+        }
+        return true;
+    }
+
+    /**
+     * @brief Spin until the copy has finished.
+     *
+     * @throws std::runtime_error if the DMAC reported an error, or on timeout
+     */
+    void wait(Ticket ticket, std::chrono::milliseconds timeout = std::chrono::seconds(10))
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!poll(ticket)) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                throw std::runtime_error("L2CPU DMA timeout");
+            }
+        }
+    }
+
+    /**
+     * @brief Acknowledge a failed copy, so it is no longer tracked.  Polling
+     * it afterwards reports it finished.  Does nothing for a ticket that
+     * didn't fail.
+     *
+     * @throws std::invalid_argument if the ticket was never issued
+     */
+    void clear_error(Ticket ticket)
+    {
+        std::unique_lock lock(mutex);
+        check_issued(ticket);
+
+        auto it = std::find(failed.begin(), failed.end(), ticket);
+        if (it != failed.end()) {
+            failed.erase(it);
+        }
+    }
+
+    /**
+     * @brief Spin until every channel is idle.  Errors are left for poll().
+     */
+    void wait_all()
+    {
+        for (size_t channel = 0; channel < NUM_CHANNELS; ++channel) {
+            std::optional<Ticket> ticket;
+            {
+                std::unique_lock lock(mutex);
+                ticket = in_flight[channel];
+            }
+            if (ticket) {
+                try {
+                    wait(*ticket);
+                } catch (const std::runtime_error&) {
+                }
+            }
+        }
+    }
+
+private:
+    // Caller holds the mutex.
+    void check_issued(Ticket ticket) const
+    {
+        if (ticket == 0 || ticket >= next_ticket) {
+            throw std::invalid_argument("L2CPU DMA: ticket was never issued");
+        }
+    }
+
+    void write64(uint64_t offset, uint64_t value)
+    {
+        registers->write32(offset + 0x0, value & 0xFFFF'FFFF);
+        registers->write32(offset + 0x4, value >> 32);
+    }
+
+    // Caller holds the mutex.  A channel with CONTROL_CLAIM set that we
+    // didn't submit to belongs to someone else.
+    std::optional<size_t> idle_channel() const
+    {
+        for (size_t channel = 0; channel < NUM_CHANNELS; ++channel) {
+            if (in_flight[channel]) {
+                continue;
+            }
+            if (registers->read32(channel * CHANNEL_STRIDE + CONTROL) & CONTROL_CLAIM) {
+                continue;
+            }
+            return channel;
+        }
+        return std::nullopt;
+    }
+
+    // Caller holds the mutex.  Releases the claim on every channel whose copy
+    // has finished, remembering which ones finished with an error.
+    void reap_completed()
+    {
+        for (size_t channel = 0; channel < NUM_CHANNELS; ++channel) {
+            if (!in_flight[channel]) {
+                continue;
+            }
+
+            const uint64_t base = channel * CHANNEL_STRIDE;
+            const uint32_t control = registers->read32(base + CONTROL);
+
+            if (control & (CONTROL_DONE | CONTROL_ERROR)) {
+                registers->write32(base + CONTROL, 0);
+
+                if (control & CONTROL_ERROR) {
+                    failed.push_back(*in_flight[channel]);
+                    if (failed.size() > MAX_TRACKED_FAILURES) {
+                        forgotten_through = std::max(forgotten_through, failed.front());
+                        failed.pop_front();
+                    }
+                }
+                in_flight[channel].reset();
+            }
+        }
+    }
+};
+
+} // namespace tt
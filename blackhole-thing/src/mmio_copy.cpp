@@ -0,0 +1,256 @@
+#include "mmio_copy.hpp"
+
+#include "atomic.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace tt {
+
+// Bytes from p to the next multiple of alignment (a power of two).
+static size_t distance_to_alignment(const void* p, size_t alignment)
+{
+    return (alignment - (reinterpret_cast<uintptr_t>(p) & (alignment - 1))) & (alignment - 1);
+}
+
+template <class T> static void scalar_access(uint8_t* dst, const uint8_t* src, bool to_device)
+{
+    T value;
+    if (to_device) {
+        std::memcpy(&value, src, sizeof(T));
+        *reinterpret_cast<volatile T*>(dst) = value;
+    } else {
+        value = *reinterpret_cast<const volatile T*>(src);
+        std::memcpy(dst, &value, sizeof(T));
+    }
+}
+
+// Widest naturally aligned access (up to 8 bytes) on the device side, one at a
+// time.  Used for everything the vector loops don't cover.
+template <bool TO_DEVICE> static void scalar_copy(uint8_t* dst, const uint8_t* src, size_t size)
+{
+    while (size > 0) {
+        const uintptr_t device = reinterpret_cast<uintptr_t>(TO_DEVICE ? dst : src);
+        size_t n;
+
+        if ((device & 7) == 0 && size >= 8) {
+            scalar_access<uint64_t>(dst, src, TO_DEVICE);
+            n = 8;
+        } else if ((device & 3) == 0 && size >= 4) {
+            scalar_access<uint32_t>(dst, src, TO_DEVICE);
+            n = 4;
+        } else if ((device & 1) == 0 && size >= 2) {
+            scalar_access<uint16_t>(dst, src, TO_DEVICE);
+            n = 2;
+        } else {
+            scalar_access<uint8_t>(dst, src, TO_DEVICE);
+            n = 1;
+        }
+
+        dst += n;
+        src += n;
+        size -= n;
+    }
+}
+
+// Splits a copy into scalar head, vector body and scalar tail around the
+// device-side pointer.  body() gets pointers with the device side aligned to
+// ALIGN and a size that is a multiple of ALIGN.
+template <bool TO_DEVICE, size_t ALIGN>
+static void copy_aligned(void* dst_, const void* src_, size_t size, void (*body)(uint8_t*, const uint8_t*, size_t))
+{
+    auto* dst = static_cast<uint8_t*>(dst_);
+    auto* src = static_cast<const uint8_t*>(src_);
+
+    const size_t head = std::min(size, distance_to_alignment(TO_DEVICE ? dst : src, ALIGN));
+    scalar_copy<TO_DEVICE>(dst, src, head);
+    dst += head;
+    src += head;
+    size -= head;
+
+    const size_t bulk = size & ~(ALIGN - 1);
+    if (bulk) {
+        body(dst, src, bulk);
+        dst += bulk;
+        src += bulk;
+        size -= bulk;
+    }
+
+    scalar_copy<TO_DEVICE>(dst, src, size);
+}
+
+static void memcpy_write(void* dst, const void* src, size_t size)
+{
+    std::memcpy(dst, src, size);
+}
+
+static void memcpy_read(void* dst, const void* src, size_t size)
+{
+    std::memcpy(dst, src, size);
+}
+
+static void scalar64_write(void* dst, const void* src, size_t size)
+{
+    scalar_copy<true>(static_cast<uint8_t*>(dst), static_cast<const uint8_t*>(src), size);
+    sfence();
+}
+
+static void scalar64_read(void* dst, const void* src, size_t size)
+{
+    scalar_copy<false>(static_cast<uint8_t*>(dst), static_cast<const uint8_t*>(src), size);
+}
+
+#if defined(__x86_64__)
+
+// Vector loops.  Device side is aligned, size is a multiple of the alignment
+// given to copy_aligned.  They are separate functions rather than lambdas so
+// that the target attribute applies to them.
+
+// Two 32-byte non-temporal stores per iteration so each 64-byte WC buffer is
+// filled completely before moving on.
+__attribute__((target("avx2"))) static void avx2_write_body(uint8_t* dst, const uint8_t* src, size_t size)
+{
+    for (size_t i = 0; i < size; i += 64) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + i), a);
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + i + 32), b);
+    }
+}
+
+__attribute__((target("avx2"))) static void avx2_read_body(uint8_t* dst, const uint8_t* src, size_t size)
+{
+    for (size_t i = 0; i < size; i += 32) {
+        __m256i a = _mm256_stream_load_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), a);
+    }
+}
+
+__attribute__((target("avx512f"))) static void avx512_write_body(uint8_t* dst, const uint8_t* src, size_t size)
+{
+    for (size_t i = 0; i < size; i += 64) {
+        __m512i a = _mm512_loadu_si512(src + i);
+        _mm512_stream_si512(reinterpret_cast<__m512i*>(dst + i), a);
+    }
+}
+
+__attribute__((target("avx512f"))) static void avx512_read_body(uint8_t* dst, const uint8_t* src, size_t size)
+{
+    for (size_t i = 0; i < size; i += 64) {
+        __m512i a = _mm512_stream_load_si512(const_cast<uint8_t*>(src + i));
+        _mm512_storeu_si512(dst + i, a);
+    }
+}
+
+static void avx2_write(void* dst, const void* src, size_t size)
+{
+    copy_aligned<true, 64>(dst, src, size, avx2_write_body);
+    sfence();
+}
+
+static void avx2_read(void* dst, const void* src, size_t size)
+{
+    copy_aligned<false, 32>(dst, src, size, avx2_read_body);
+}
+
+static void avx512_write(void* dst, const void* src, size_t size)
+{
+    copy_aligned<true, 64>(dst, src, size, avx512_write_body);
+    sfence();
+}
+
+static void avx512_read(void* dst, const void* src, size_t size)
+{
+    copy_aligned<false, 64>(dst, src, size, avx512_read_body);
+}
+
+#elif defined(__aarch64__)
+
+// ARM faults on unaligned Device memory accesses, hence the head/tail split
+// even though NEON itself doesn't care about alignment.
+static void neon_write_body(uint8_t* dst, const uint8_t* src, size_t size)
+{
+    for (size_t i = 0; i < size; i += 64) {
+        uint8x16_t a = vld1q_u8(src + i);
+        uint8x16_t b = vld1q_u8(src + i + 16);
+        uint8x16_t c = vld1q_u8(src + i + 32);
+        uint8x16_t d = vld1q_u8(src + i + 48);
+        vst1q_u8(dst + i, a);
+        vst1q_u8(dst + i + 16, b);
+        vst1q_u8(dst + i + 32, c);
+        vst1q_u8(dst + i + 48, d);
+    }
+}
+
+static void neon_read_body(uint8_t* dst, const uint8_t* src, size_t size)
+{
+    for (size_t i = 0; i < size; i += 16) {
+        vst1q_u8(dst + i, vld1q_u8(src + i));
+    }
+}
+
+static void neon_write(void* dst, const void* src, size_t size)
+{
+    copy_aligned<true, 64>(dst, src, size, neon_write_body);
+    sfence();
+}
+
+static void neon_read(void* dst, const void* src, size_t size)
+{
+    copy_aligned<false, 16>(dst, src, size, neon_read_body);
+}
+
+#endif
+
+static std::vector<MmioCopyKernel> detect_mmio_copy_kernels()
+{
+    std::vector<MmioCopyKernel> kernels{
+        {"memcpy", memcpy_write, memcpy_read},
+        {"scalar64", scalar64_write, scalar64_read},
+    };
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back({"avx2", avx2_write, avx2_read});
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        kernels.push_back({"avx512", avx512_write, avx512_read});
+    }
+#elif defined(__aarch64__)
+    kernels.push_back({"neon", neon_write, neon_read});
+#endif
+
+    return kernels;
+}
+
+const std::vector<MmioCopyKernel>& mmio_copy_kernels()
+{
+    static const std::vector<MmioCopyKernel> kernels = detect_mmio_copy_kernels();
+    return kernels;
+}
+
+const MmioCopyKernel& mmio_copy_kernel()
+{
+    static const MmioCopyKernel& kernel = mmio_copy_kernels().back();
+    return kernel;
+}
+
+void mmio_write(void* dst, const void* src, size_t size)
+{
+    mmio_copy_kernel().write(dst, src, size);
+}
+
+void mmio_read(void* dst, const void* src, size_t size)
+{
+    mmio_copy_kernel().read(dst, src, size);
+}
+
+} // namespace tt
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace tt {
+
+/**
+ * @brief A pair of routines for copying between host memory and a TLB window.
+ *
+ * write: dst is device memory, src is host memory
+ * read:  dst is host memory, src is device memory
+ *
+ * Apart from memcpy, every kernel uses naturally aligned accesses on the
+ * device side: scalar loads/stores (widest first) until the device pointer is
+ * aligned, then full vector width, then scalar again for the tail.  Source and
+ * destination on the host side may have any alignment.
+ */
+struct MmioCopyKernel
+{
+    const char* name;
+    void (*write)(void* dst, const void* src, size_t size);
+    void (*read)(void* dst, const void* src, size_t size);
+};
+
+/**
+ * @brief Every kernel this CPU can run, narrowest first.
+ *
+ * The first entry is plain memcpy, the second is the portable 64-bit scalar
+ * fallback; after that come whatever vector kernels CPU feature detection
+ * allows (AVX2 and AVX-512 on x86, NEON on ARM).
+ */
+const std::vector<MmioCopyKernel>& mmio_copy_kernels();
+
+/**
+ * @brief The kernel used by mmio_write/mmio_read: the widest one available.
+ */
+const MmioCopyKernel& mmio_copy_kernel();
+
+/**
+ * @brief Copy host memory into a TLB window.
+ *
+ * Vector stores are non-temporal where the ISA has them, so a WC window sees
+ * full 64-byte bursts.  Ends with a store fence.
+ */
+void mmio_write(void* dst, const void* src, size_t size);
+
+/**
+ * @brief Copy from a TLB window into host memory.
+ */
+void mmio_read(void* dst, const void* src, size_t size);
+
+} // namespace tt
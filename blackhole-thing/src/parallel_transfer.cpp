@@ -0,0 +1,99 @@
+#include "parallel_transfer.hpp"
+
+#include "utility.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+namespace tt {
+
+ParallelTransfer::ParallelTransfer(BlackholePciDevice& device, size_t num_threads)
+    : device(device)
+    , num_threads(num_threads)
+{
+    if (num_threads == 0) {
+        throw std::invalid_argument("ParallelTransfer needs at least one thread");
+    }
+}
+
+std::vector<NocTarget> ParallelTransfer::dram_channel_targets(uint64_t address)
+{
+    std::vector<NocTarget> targets;
+    for (size_t i = 0; i < Blackhole::NUM_DRAM_CHANNELS; ++i) {
+        if (Blackhole::DRAM_CHANNEL_BACKS_X280[i]) {
+            continue;
+        }
+        const auto& channel = Blackhole::DRAM_LOCATIONS[i];
+        targets.push_back({channel[0].x, channel[0].y, address});
+    }
+    return targets;
+}
+
+TransferReport ParallelTransfer::write(const std::vector<NocTarget>& targets, const void* src, size_t size)
+{
+    // run() does not write through the host pointer when copying to device.
+    return run(targets, static_cast<uint8_t*>(const_cast<void*>(src)), size, true);
+}
+
+TransferReport ParallelTransfer::read(const std::vector<NocTarget>& targets, void* dst, size_t size)
+{
+    return run(targets, static_cast<uint8_t*>(dst), size, false);
+}
+
+TransferReport ParallelTransfer::run(const std::vector<NocTarget>& targets, uint8_t* host, size_t size,
+                                     bool to_device)
+{
+    if (targets.empty()) {
+        throw std::invalid_argument("ParallelTransfer needs at least one target");
+    }
+
+    const size_t slice_size = (((size + num_threads - 1) / num_threads) + 63) & ~size_t(63);
+
+    TransferReport report{};
+    report.bytes = size;
+    report.threads.resize(num_threads);
+
+    std::vector<std::exception_ptr> errors(num_threads);
+    std::vector<std::thread> threads;
+
+    Timer timer;
+    for (size_t i = 0; i < num_threads; ++i) {
+        const size_t offset = std::min(size, i * slice_size);
+        const size_t bytes = std::min(size - offset, slice_size);
+        const auto& base = targets[i % targets.size()];
+        const NocTarget target{base.x, base.y, base.address + (i / targets.size()) * slice_size};
+
+        report.threads[i] = TransferThreadStats{target, bytes, 0};
+
+        threads.emplace_back([&, i, offset, bytes, target]() {
+            try {
+                Timer thread_timer;
+                if (to_device) {
+                    device.write(target.x, target.y, target.address, host + offset, bytes);
+                } else {
+                    device.read(target.x, target.y, target.address, host + offset, bytes);
+                }
+                report.threads[i].ns = thread_timer.elapsed_ns();
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    report.ns = timer.elapsed_ns();
+
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    return report;
+}
+
+} // namespace tt
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "blackhole_grid.hpp"
+#include "blackhole_pcie.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace tt {
+
+/**
+ * @brief Where one share of a parallel transfer lands on the NOC.
+ */
+struct NocTarget
+{
+    uint32_t x;
+    uint32_t y;
+    uint64_t address;
+};
+
+/**
+ * @brief Timing for one worker thread of a parallel transfer.
+ */
+struct TransferThreadStats
+{
+    NocTarget target;
+    size_t bytes;
+    uint64_t ns;
+
+    double gib_per_sec() const
+    {
+        return ns ? (bytes / double(1ULL << 30)) / (ns / 1e9) : 0.0;
+    }
+};
+
+/**
+ * @brief Timing for a whole parallel transfer.
+ *
+ * ns is wall time from the first thread starting to the last one finishing,
+ * so gib_per_sec() is the aggregate rate actually achieved.
+ */
+struct TransferReport
+{
+    std::vector<TransferThreadStats> threads;
+    size_t bytes;
+    uint64_t ns;
+
+    double gib_per_sec() const
+    {
+        return ns ? (bytes / double(1ULL << 30)) / (ns / 1e9) : 0.0;
+    }
+};
+
+/**
+ * @brief Splits a large host buffer across worker threads, each moving its
+ * share through its own WC windows.
+ *
+ * The buffer is cut into num_threads contiguous slices (64-byte multiples,
+ * except possibly the last).  Slice i goes to targets[i % targets.size()].
+ * Slices that share a target are laid out back to back from that target's
+ * address, so with a single target the device sees one contiguous copy of the
+ * buffer, and with one target per DRAM channel it sees the buffer striped
+ * across channels.
+ *
+ * Each worker uses BlackholePciDevice::read/write, i.e. two ping-ponged 2 MiB
+ * WC windows per thread.
+ */
+class ParallelTransfer
+{
+    BlackholePciDevice& device;
+    const size_t num_threads;
+
+public:
+    /**
+     * @param device must outlive this object
+     * @param num_threads number of worker threads per transfer
+     */
+    ParallelTransfer(BlackholePciDevice& device, size_t num_threads);
+
+    /**
+     * @brief One target per DRAM channel, all at the same address.
+     *
+     * Channels that back an X280 (Blackhole::DRAM_CHANNEL_BACKS_X280) are
+     * left out, so striping a write across channels can't overwrite memory a
+     * running X280 is using.
+     */
+    static std::vector<NocTarget> dram_channel_targets(uint64_t address);
+
+    TransferReport write(const std::vector<NocTarget>& targets, const void* src, size_t size);
+    TransferReport read(const std::vector<NocTarget>& targets, void* dst, size_t size);
+
+private:
+    TransferReport run(const std::vector<NocTarget>& targets, uint8_t* host, size_t size, bool to_device);
+};
+
+} // namespace tt
@@ -1,8 +1,17 @@
 #pragma once
 
+#include "atomic.hpp"
 #include "blackhole_pcie.hpp"
+#include "register_aperture.hpp"
+#include "resource_handle.hpp"
+#include "tlb_entry_allocator.hpp"
 #include "tlb_window.hpp"
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace tt {
 
@@ -22,6 +31,117 @@ struct __attribute__((packed)) NocTlbData
     uint32_t reserved1 : 3;
 };
 
+enum class PcieOrdering
+{
+    Strict,
+    Relaxed,
+};
+
+/**
+ * @brief Attributes for outbound (NOC to PCIe) traffic through a PCIe core,
+ * for PCIeCore::map_outbound.
+ *
+ * Relaxed sets the RO attribute on the TLPs, which lets the root complex
+ * (and anything between) complete writes out of order.  That is worth real
+ * bandwidth on some hosts but breaks the usual "write the data, then write
+ * the flag" pattern if both go out relaxed.  A posted write without RO may
+ * not pass earlier posted writes, RO or not, so the safe way to use it is
+ * bulk data through a relaxed window and the flag or doorbell that follows
+ * through a strict one.
+ */
+struct OutboundTlbConfig
+{
+    bool atu_bypass = true; // NOC address (minus the window base) is the bus address, e.g. an IOVA
+    PcieOrdering ordering = PcieOrdering::Strict;
+    uint32_t traffic_class = 0; // TC0-7; only useful if the host maps TCs to VCs
+    bool no_snoop = false;
+
+    static OutboundTlbConfig strict() { return {}; }
+
+    static OutboundTlbConfig relaxed()
+    {
+        OutboundTlbConfig config;
+        config.ordering = PcieOrdering::Relaxed;
+        return config;
+    }
+
+    OutboundTlbConfig with_traffic_class(uint32_t tc) const
+    {
+        OutboundTlbConfig config = *this;
+        config.traffic_class = tc;
+        return config;
+    }
+
+    NocTlbData data() const
+    {
+        NocTlbData data{};
+        data.atu_bypass = atu_bypass;
+        data.ro = ordering == PcieOrdering::Relaxed;
+        data.tc = traffic_class;
+        data.ns = no_snoop;
+        return data;
+    }
+};
+
+/**
+ * @brief An outbound NOC-to-PCIe TLB entry, from PCIeCore::map_outbound.
+ *
+ * NOC accesses to the PCIe core at get_noc_address() + bus address go out
+ * on PCIe with this entry's attributes.  Destroying it releases the entry.
+ */
+class PcieOutboundWindow : ReleaseOnDestroy
+{
+    const uint64_t noc_address;
+    const size_t tlb_index;
+
+public:
+    PcieOutboundWindow(uint64_t noc_address, size_t tlb_index, std::function<void()> release)
+        : ReleaseOnDestroy(std::move(release))
+        , noc_address(noc_address)
+        , tlb_index(tlb_index)
+    {
+    }
+
+    uint64_t get_noc_address() const { return noc_address; }
+    size_t get_tlb_index() const { return tlb_index; }
+};
+
+/**
+ * @brief Access to a PCIe core's DBI (controller configuration) space.
+ *
+ * DBI is reached through an outbound NOC TLB entry with the dbi bit set.  The
+ * session assumes nobody else reprograms that entry.  Addresses are offsets
+ * into DBI space; accesses go through the device's cached UC windows, so
+ * pages already touched cost only the access.  Get one from
+ * PCIeCore::dbi_session().
+ */
+class DbiSession
+{
+    RegisterAperture registers;
+
+public:
+    /**
+     * @param access_address NOC address of DBI space, from configure_noc_tlb_data
+     */
+    DbiSession(BlackholePciDevice& device, uint32_t noc_x, uint32_t noc_y, uint64_t access_address)
+        : registers(device, noc_x, noc_y, access_address)
+    {
+    }
+
+    DbiSession(const DbiSession&) = delete;
+    DbiSession& operator=(const DbiSession&) = delete;
+
+    uint32_t read32(uint64_t address) { return registers.read32(address); }
+    void write32(uint64_t address, uint32_t value) { registers.write32(address, value); }
+
+    /**
+     * @brief Apply reads and writes in order, with one fence at the end.
+     *
+     * @param ops reads have their value filled in
+     */
+    void apply(std::vector<RegisterOp>& ops) { registers.apply(ops); }
+};
+
 /**
  * @brief One PCIe core in Blackhole.
  *
@@ -35,72 +155,121 @@ class PCIeCore
     static constexpr uint64_t SII_A = 0xFFFF'FFFF'F000'0000ULL;
     static constexpr size_t DBI_TLB_INDEX = 20;
 
+    // The entry index is NOC address bits 63:58.
+    static constexpr size_t NUM_OUTBOUND_TLBS = 64;
+
     BlackholePciDevice& device;
     const uint32_t our_noc0_x;
     const uint32_t our_noc0_y;
 
+    std::mutex dbi_mutex;
+    std::unique_ptr<DbiSession> dbi;
+
+    std::shared_ptr<TlbEntryAllocator> outbound_tlbs;
+
 public:
+    // Firmware leaves this entry going through the iATU rather than bypassing
+    // it; memory_for_x280 reaches pinned host memory through it.  Never
+    // handed out.
+    static constexpr size_t IATU_TLB_INDEX = 4;
+
     PCIeCore(BlackholePciDevice& device, uint32_t noc_x, uint32_t noc_y)
         : device(device)
         , our_noc0_x(noc_x)
         , our_noc0_y(noc_y)
+        , outbound_tlbs(shared_outbound_tlbs(device, noc_x, noc_y))
     {
     }
 
     void write_sii32(uint64_t addr, uint32_t value)
     {
-        auto tlb = device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, SII_A);
+        auto tlb = device.map_tlb_2M_UC_cached(our_noc0_x, our_noc0_y, SII_A);
         tlb->write32(addr, value);
     }
 
     uint32_t read_sii32(uint64_t addr)
     {
-        auto tlb = device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, SII_A);
+        auto tlb = device.map_tlb_2M_UC_cached(our_noc0_x, our_noc0_y, SII_A);
         return tlb->read32(addr);
     }
 
+    /**
+     * @brief The DBI session for this core.  The first call programs outbound
+     * NOC TLB entry DBI_TLB_INDEX for DBI; the session lives as long as this
+     * object.
+     */
+    DbiSession& dbi_session()
+    {
+        std::scoped_lock lock(dbi_mutex);
+        if (!dbi) {
+            NocTlbData data{};
+            data.dbi = 1;
+
+            uint64_t access_address = configure_noc_tlb_data(DBI_TLB_INDEX, data);
+            dbi = std::make_unique<DbiSession>(device, our_noc0_x, our_noc0_y, access_address);
+        }
+        return *dbi;
+    }
+
     uint32_t read_dbi_register(uint64_t addr)
     {
-        const NocTlbData data{.dbi = 1};
-        uint64_t access_address = configure_noc_tlb_data(DBI_TLB_INDEX, data);
-        auto tlb = device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, access_address + addr);
-        return tlb->read32(0);
+        return dbi_session().read32(addr);
     }
 
     void write_dbi_register(uint64_t addr, uint32_t value)
     {
-        NocTlbData data{};
-        data.dbi = 1;
-
-        uint64_t access_address = configure_noc_tlb_data(DBI_TLB_INDEX, data);
-
-        auto tlb = device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, access_address + addr);
-        tlb->write32(0, value);
+        dbi_session().write32(addr, value);
     }
 
     /**
      * @brief Configure a NOC outbound TLB entry.
      *
+     * The index is taken out of the map_outbound pool for good.  Prefer
+     * map_outbound unless something else expects a particular entry.
+     *
      * @param index which entry to configure
      * @param data parameters
      * @return address of 58 bit access window
      */
     uint64_t configure_noc_tlb_data(size_t index, const NocTlbData& data)
     {
-        const uint64_t config_address = 0x134 + (4 * index);
-        const uint64_t access_address = index << 58;
-        auto registers = device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, SII_A);
+        outbound_tlbs->reserve(index);
+        return program_noc_tlb_data(index, data);
+    }
+
+    /**
+     * @brief Get an outbound TLB entry with these attributes.
+     *
+     * Entries are shared: every caller asking for the same attributes gets
+     * the same entry, and an idle entry keeps its attributes until another
+     * configuration needs the slot.  The allocator is shared by every
+     * PCIeCore object for this core on this device; other processes are not
+     * coordinated with.
+     *
+     * @throws std::runtime_error if every entry is in use or reserved
+     */
+    std::unique_ptr<PcieOutboundWindow> map_outbound(const OutboundTlbConfig& config)
+    {
+        const NocTlbData data = config.data();
+        const uint64_t key = noc_tlb_data_word(data);
 
-        registers->write32(config_address, *reinterpret_cast<const uint32_t*>(&data));
+        auto tlbs = outbound_tlbs;
+        const size_t index = tlbs->acquire(key, [&](size_t index) { program_noc_tlb_data(index, data); });
 
-        return access_address;
+        auto release = [tlbs, index]() { tlbs->release(index); };
+        return std::make_unique<PcieOutboundWindow>(uint64_t(index) << 58, index, release);
+    }
+
+    TlbOccupancy get_outbound_occupancy()
+    {
+        return outbound_tlbs->occupancy();
     }
 
     void dump_noc_tlb_data(size_t index)
     {
         const uint64_t config_address = 0x134 + (4 * index);
         const uint64_t access_address = index << 58;
-        auto registers = device.map_tlb_2M_UC(our_noc0_x, our_noc0_y, SII_A);
+        auto registers = device.map_tlb_2M_UC_cached(our_noc0_x, our_noc0_y, SII_A);
         uint32_t data = registers->read32(config_address);
         NocTlbData* tlb_data = reinterpret_cast<NocTlbData*>(&data);
         std::cout << "tlp_type: " << tlb_data->tlp_type << "\n";
@@ -140,16 +309,53 @@ public:
         uint32_t target_lo = (target >> 0x00) & 0xFFFF'FFFF;
         uint32_t target_hi = (target >> 0x20) & 0xFFFF'FFFF;
 
-        write_dbi_register(reg_base + IATU_REGION_CTRL_1_OFF_INBOUND_0, 0x0);
-        write_dbi_register(reg_base + IATU_REGION_CTRL_2_OFF_INBOUND_0, enable);
-        write_dbi_register(reg_base + IATU_LWR_BASE_ADDR_OFF_INBOUND_0, base_lo);
-        write_dbi_register(reg_base + IATU_UPPER_BASE_ADDR_OFF_INBOUND_0, base_hi);
-        write_dbi_register(reg_base + IATU_LIMIT_ADDR_OFF_INBOUND_0, limit);
-        write_dbi_register(reg_base + IATU_LWR_TARGET_ADDR_OFF_INBOUND_0, target_lo);
-        write_dbi_register(reg_base + IATU_UPPER_TARGET_ADDR_OFF_INBOUND_0, target_hi);
+        std::vector<RegisterOp> ops = {
+            RegisterOp::write(reg_base + IATU_REGION_CTRL_1_OFF_INBOUND_0, 0x0),
+            RegisterOp::write(reg_base + IATU_REGION_CTRL_2_OFF_INBOUND_0, enable),
+            RegisterOp::write(reg_base + IATU_LWR_BASE_ADDR_OFF_INBOUND_0, base_lo),
+            RegisterOp::write(reg_base + IATU_UPPER_BASE_ADDR_OFF_INBOUND_0, base_hi),
+            RegisterOp::write(reg_base + IATU_LIMIT_ADDR_OFF_INBOUND_0, limit),
+            RegisterOp::write(reg_base + IATU_LWR_TARGET_ADDR_OFF_INBOUND_0, target_lo),
+            RegisterOp::write(reg_base + IATU_UPPER_TARGET_ADDR_OFF_INBOUND_0, target_hi),
+
+            // TODO: Do we get more than 4GiB/region??  Outbound in GS/WH did not.
+            RegisterOp::write(reg_base + IATU_UPPR_LIMIT_ADDR_OFF_INBOUND_0, 0x0),
+        };
+        dbi_session().apply(ops);
+    }
+
+private:
+    static uint32_t noc_tlb_data_word(const NocTlbData& data)
+    {
+        uint32_t word;
+        std::memcpy(&word, &data, sizeof(word));
+        return word;
+    }
+
+    uint64_t program_noc_tlb_data(size_t index, const NocTlbData& data)
+    {
+        const uint64_t config_address = 0x134 + (4 * index);
+        const uint64_t access_address = index << 58;
+        auto registers = device.map_tlb_2M_UC_cached(our_noc0_x, our_noc0_y, SII_A);
+
+        registers->write32(config_address, noc_tlb_data_word(data));
+
+        return access_address;
+    }
+
+    // One allocator per (device, PCIe core), shared by every PCIeCore object
+    // for that core.  The DBI and iATU entries are never handed out.
+    static std::shared_ptr<TlbEntryAllocator> shared_outbound_tlbs(BlackholePciDevice& device, uint32_t noc_x,
+                                                                   uint32_t noc_y)
+    {
+        static PerTileRegistry<TlbEntryAllocator> registry;
 
-        // TODO: Do we get more than 4GiB/region??  Outbound in GS/WH did not.
-        write_dbi_register(base + IATU_UPPR_LIMIT_ADDR_OFF_INBOUND_0, 0x0);
+        return registry.get(device, noc_x, noc_y, [] {
+            auto tlbs = std::make_shared<TlbEntryAllocator>(NUM_OUTBOUND_TLBS);
+            tlbs->reserve(DBI_TLB_INDEX);
+            tlbs->reserve(IATU_TLB_INDEX);
+            return tlbs;
+        });
     }
 };
 
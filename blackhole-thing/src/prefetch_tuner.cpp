@@ -0,0 +1,236 @@
+#include "prefetch_tuner.hpp"
+
+#include "atomic.hpp"
+#include "logger.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+namespace tt {
+
+PrefetcherSetting PrefetcherSetting::decode(uint32_t ctrl0, uint32_t ctrl1)
+{
+    l2cpu::PrefetcherCtrl0 c0;
+    l2cpu::PrefetcherCtrl1 c1;
+    c0.value = ctrl0;
+    c1.value = ctrl1;
+
+    PrefetcherSetting setting;
+    setting.initial_dist = c0.bits.initialDist;
+    setting.max_allowed_dist = c0.bits.maxAllowedDist;
+    setting.lin_to_exp_thrd = c0.bits.linToExpThrd;
+    setting.window = c1.bits.window;
+    setting.scalar_load = c0.bits.scalarLoadSupportEn;
+    setting.scalar_store = c1.bits.scalarStoreSupportEn;
+    setting.vector_load = c1.bits.vectorLoadSupportEn;
+    setting.vector_store = c1.bits.vectorStoreSupportEn;
+    return setting;
+}
+
+void PrefetcherSetting::encode(uint32_t& ctrl0, uint32_t& ctrl1) const
+{
+    l2cpu::PrefetcherCtrl0 c0;
+    l2cpu::PrefetcherCtrl1 c1;
+    c0.value = ctrl0;
+    c1.value = ctrl1;
+
+    c0.bits.initialDist = initial_dist;
+    c0.bits.maxAllowedDist = max_allowed_dist;
+    c0.bits.linToExpThrd = lin_to_exp_thrd;
+    c1.bits.window = window;
+    c0.bits.scalarLoadSupportEn = scalar_load;
+    c1.bits.scalarStoreSupportEn = scalar_store;
+    c1.bits.vectorLoadSupportEn = vector_load;
+    c1.bits.vectorStoreSupportEn = vector_store;
+
+    ctrl0 = c0.value;
+    ctrl1 = c1.value;
+}
+
+PrefetchTuner::PrefetchTuner(BlackholePciDevice& device, L2CPU& l2cpu, uint64_t slot_address)
+    : l2cpu(l2cpu)
+    , window(device.map_tlb_2M_UC(l2cpu.get_noc0_x(), l2cpu.get_noc0_y(), slot_address))
+{
+    if (window->size() < sizeof(PrefetchTuneSlot)) {
+        throw std::runtime_error("PrefetchTuneSlot straddles a 2 MiB boundary");
+    }
+    if (slot()->magic != PrefetchTuneSlot::MAGIC) {
+        throw std::runtime_error("No prefetch tuning program is running on the X280");
+    }
+
+    // Pick up where a previous run left off so a stale done doesn't match.
+    sequence = slot()->done;
+
+    for (size_t core = 0; core < L2CPU::num_cores(); ++core) {
+        original.push_back(l2cpu.read_prefetcher(core));
+    }
+}
+
+PrefetchTuner::~PrefetchTuner()
+{
+    try {
+        for (size_t core = 0; core < original.size(); ++core) {
+            l2cpu.set_prefetcher(core, original[core].first, original[core].second);
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR("PrefetchTuner: failed to restore prefetcher settings: {}", e.what());
+    }
+}
+
+void PrefetchTuner::keep(uint32_t ctrl0, uint32_t ctrl1)
+{
+    for (auto& core : original) {
+        core = {ctrl0, ctrl1};
+    }
+}
+
+volatile PrefetchTuneSlot* PrefetchTuner::slot()
+{
+    return window->as<volatile PrefetchTuneSlot*>();
+}
+
+uint64_t PrefetchTuner::run(uint32_t workload)
+{
+    auto* s = slot();
+
+    s->workload = workload;
+    s->iterations = iterations;
+    mfence();
+    s->sequence = ++sequence;
+    mfence();
+
+    Timer timer;
+    const uint64_t timeout_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+    while (s->done != sequence) {
+        if (timer.elapsed_ns() > timeout_ns) {
+            throw std::runtime_error("Timed out waiting for the X280 workload");
+        }
+        std::this_thread::yield();
+    }
+
+    if (s->status != 0) {
+        throw std::runtime_error("X280 workload failed with status " + std::to_string(s->status));
+    }
+    return s->cycles;
+}
+
+PrefetchResult PrefetchTuner::measure(uint32_t ctrl0, uint32_t ctrl1, const std::vector<uint32_t>& workloads)
+{
+    l2cpu.set_prefetcher(ctrl0, ctrl1);
+
+    PrefetchResult result{PrefetcherSetting::decode(ctrl0, ctrl1), ctrl0, ctrl1, {}};
+    for (auto workload : workloads) {
+        run(workload); // warm up: caches and prefetcher state left by the last candidate
+
+        std::vector<uint64_t> samples;
+        for (size_t i = 0; i < repeats; ++i) {
+            samples.push_back(run(workload));
+        }
+        std::sort(samples.begin(), samples.end());
+        result.cycles.push_back(samples.empty() ? 0 : samples[samples.size() / 2]);
+    }
+    return result;
+}
+
+static bool dominates(const PrefetchResult& a, const PrefetchResult& b)
+{
+    bool better = false;
+    for (size_t i = 0; i < a.cycles.size(); ++i) {
+        if (a.cycles[i] > b.cycles[i]) {
+            return false;
+        }
+        better |= a.cycles[i] < b.cycles[i];
+    }
+    return better;
+}
+
+std::vector<size_t> PrefetchTuner::pareto_front(const std::vector<PrefetchResult>& results)
+{
+    std::vector<size_t> front;
+    for (size_t i = 0; i < results.size(); ++i) {
+        bool dominated = false;
+        for (size_t j = 0; j < results.size() && !dominated; ++j) {
+            dominated = j != i && dominates(results[j], results[i]);
+        }
+        if (!dominated) {
+            front.push_back(i);
+        }
+    }
+    return front;
+}
+
+std::vector<PrefetchResult> PrefetchTuner::tune(const PrefetchSweep& sweep, uint32_t base_ctrl0, uint32_t base_ctrl1,
+                                                const std::vector<uint32_t>& workloads, const Progress& progress)
+{
+    const PrefetcherSetting base = PrefetcherSetting::decode(base_ctrl0, base_ctrl1);
+
+    std::vector<PrefetcherSetting> distances;
+    for (auto initial : sweep.initial_dist) {
+        for (auto max_allowed : sweep.max_allowed_dist) {
+            if (initial > max_allowed) {
+                continue;
+            }
+            for (auto lin_to_exp : sweep.lin_to_exp_thrd) {
+                for (auto window : sweep.window) {
+                    PrefetcherSetting setting = base;
+                    setting.initial_dist = initial;
+                    setting.max_allowed_dist = max_allowed;
+                    setting.lin_to_exp_thrd = lin_to_exp;
+                    setting.window = window;
+                    distances.push_back(setting);
+                }
+            }
+        }
+    }
+
+    // Worst case total, for progress reporting; stage two is usually smaller.
+    size_t total = distances.size();
+    size_t done = 0;
+
+    std::vector<PrefetchResult> results;
+    auto try_setting = [&](const PrefetcherSetting& setting) {
+        uint32_t ctrl0 = base_ctrl0;
+        uint32_t ctrl1 = base_ctrl1;
+        setting.encode(ctrl0, ctrl1);
+        results.push_back(measure(ctrl0, ctrl1, workloads));
+        if (progress) {
+            progress(results.back(), ++done, total);
+        }
+    };
+
+    for (const auto& setting : distances) {
+        try_setting(setting);
+    }
+
+    if (!sweep.sweep_enables) {
+        return results;
+    }
+
+    std::vector<PrefetcherSetting> front;
+    for (auto i : pareto_front(results)) {
+        front.push_back(results[i].setting);
+    }
+    total += front.size() * 15;
+
+    for (const auto& best : front) {
+        for (uint32_t enables = 0; enables < 16; ++enables) {
+            PrefetcherSetting setting = best;
+            setting.scalar_load = enables & 1;
+            setting.scalar_store = enables & 2;
+            setting.vector_load = enables & 4;
+            setting.vector_store = enables & 8;
+
+            bool same = setting.scalar_load == best.scalar_load && setting.scalar_store == best.scalar_store &&
+                        setting.vector_load == best.vector_load && setting.vector_store == best.vector_store;
+            if (!same) {
+                try_setting(setting);
+            }
+        }
+    }
+
+    return results;
+}
+
+} // namespace tt
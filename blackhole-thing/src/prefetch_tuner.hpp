@@ -0,0 +1,173 @@
+#pragma once
+
+#include "blackhole_pcie.hpp"
+#include "l2cpu_core.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace tt {
+
+/**
+ * @brief Mailbox shared between PrefetchTuner on the host and a benchmark
+ * program on the X280, in X280 DRAM.
+ *
+ * The X280 side writes magic once it is polling.  To start a run the host
+ * fills in workload and iterations, then bumps sequence.  The X280 side runs
+ * the workload, stores cycles (rdcycle delta) and status, then copies
+ * sequence into done.
+ *
+ * The X280 side must see the host's writes and the host must see its
+ * replies, so it should map the slot uncached or flush around each access.
+ */
+struct PrefetchTuneSlot
+{
+    static constexpr uint32_t MAGIC = 0x4e544650; // "PFTN"
+
+    uint32_t magic;      // X280
+    uint32_t sequence;   // host
+    uint32_t workload;   // host; meaning is up to the X280 program
+    uint32_t iterations; // host
+    uint32_t done;       // X280
+    uint32_t status;     // X280; 0 on success
+    uint64_t cycles;     // X280
+};
+
+/**
+ * @brief The prefetcher fields PrefetchTuner sweeps, decoded.
+ */
+struct PrefetcherSetting
+{
+    uint32_t initial_dist;
+    uint32_t max_allowed_dist;
+    uint32_t lin_to_exp_thrd;
+    uint32_t window;
+    bool scalar_load;
+    bool scalar_store;
+    bool vector_load;
+    bool vector_store;
+
+    /**
+     * @brief Read the swept fields out of a pair of register values.
+     */
+    static PrefetcherSetting decode(uint32_t ctrl0, uint32_t ctrl1);
+
+    /**
+     * @brief Replace the swept fields in a pair of register values, leaving
+     * the rest (thresholds, crossPageEn, ...) as they were.
+     */
+    void encode(uint32_t& ctrl0, uint32_t& ctrl1) const;
+};
+
+/**
+ * @brief Ranges to sweep.  Combinations with initial_dist > max_allowed_dist
+ * are skipped.
+ */
+struct PrefetchSweep
+{
+    std::vector<uint32_t> initial_dist = {1, 2, 4, 8, 16};
+    std::vector<uint32_t> max_allowed_dist = {8, 16, 24, 32, 63};
+    std::vector<uint32_t> lin_to_exp_thrd = {2, 5, 16};
+    std::vector<uint32_t> window = {8, 16, 32};
+    bool sweep_enables = true; // all 16 scalar/vector load/store combinations
+};
+
+/**
+ * @brief One candidate's timings: median cycles per workload, in the order
+ * the workloads were given.
+ */
+struct PrefetchResult
+{
+    PrefetcherSetting setting;
+    uint32_t ctrl0;
+    uint32_t ctrl1;
+    std::vector<uint64_t> cycles;
+};
+
+/**
+ * @brief Searches the X280 L2 prefetcher settings for the fastest ones for a
+ * set of workloads.
+ *
+ * For each candidate it programs all four cores' prefetchers, asks the X280
+ * program behind the PrefetchTuneSlot to run each workload, and records the
+ * median reported cycle count.  x280-prefetch/prefetch_worker.cpp is a
+ * minimal X280 program that serves the slot.
+ *
+ * The sweep runs in two stages so it finishes in reasonable time.  Distances
+ * and window are swept first with the base settings' enables, then the
+ * enables are swept for each setting on the first stage's Pareto front.
+ *
+ * Each core's prefetcher settings are restored on destruction; a failure to
+ * restore them is logged, not thrown.
+ */
+class PrefetchTuner
+{
+public:
+    using Progress = std::function<void(const PrefetchResult&, size_t done, size_t total)>;
+
+    /**
+     * @param slot_address NOC address of the PrefetchTuneSlot on the L2CPU tile
+     * @throws std::runtime_error if the X280 program is not there
+     */
+    PrefetchTuner(BlackholePciDevice& device, L2CPU& l2cpu, uint64_t slot_address);
+    ~PrefetchTuner();
+
+    PrefetchTuner(const PrefetchTuner&) = delete;
+    PrefetchTuner& operator=(const PrefetchTuner&) = delete;
+
+    void set_iterations(uint32_t n) { iterations = n; }
+    void set_repeats(size_t n) { repeats = n; }
+    void set_timeout(std::chrono::milliseconds t) { timeout = t; }
+
+    /**
+     * @brief Run one workload once with whatever the prefetchers are set to.
+     *
+     * @return cycles reported by the X280
+     * @throws std::runtime_error on timeout or non-zero status
+     */
+    uint64_t run(uint32_t workload);
+
+    /**
+     * @brief Time one candidate on every workload.
+     */
+    PrefetchResult measure(uint32_t ctrl0, uint32_t ctrl1, const std::vector<uint32_t>& workloads);
+
+    /**
+     * @brief The two-stage sweep described above, starting from base.
+     *
+     * @return every candidate measured
+     */
+    std::vector<PrefetchResult> tune(const PrefetchSweep& sweep, uint32_t base_ctrl0, uint32_t base_ctrl1,
+                                     const std::vector<uint32_t>& workloads, const Progress& progress = {});
+
+    /**
+     * @brief Indices of the results no other result beats on every workload.
+     *
+     * With a single workload that is just the fastest (and any ties).
+     */
+    static std::vector<size_t> pareto_front(const std::vector<PrefetchResult>& results);
+
+    /**
+     * @brief Keep these settings instead of restoring the original ones.
+     */
+    void keep(uint32_t ctrl0, uint32_t ctrl1);
+
+private:
+    volatile PrefetchTuneSlot* slot();
+
+    L2CPU& l2cpu;
+    std::unique_ptr<TlbWindow> window;
+
+    std::vector<std::pair<uint32_t, uint32_t>> original; // per core
+
+    uint32_t sequence = 0;
+    uint32_t iterations = 1;
+    size_t repeats = 5;
+    std::chrono::milliseconds timeout{10'000};
+};
+
+} // namespace tt
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "atomic.hpp"
+#include "blackhole_pcie.hpp"
+#include "tlb_window.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace tt {
+
+/**
+ * @brief One register access for RegisterAperture::apply.
+ *
+ * Reads store what they read in value.
+ */
+struct RegisterOp
+{
+    enum class Type { Read, Write };
+
+    Type type;
+    uint64_t address;
+    uint32_t value;
+
+    static RegisterOp read(uint64_t address) { return {Type::Read, address, 0}; }
+    static RegisterOp write(uint64_t address, uint32_t value) { return {Type::Write, address, value}; }
+};
+
+/**
+ * @brief 32-bit register access to one tile's address space.
+ *
+ * Windows come from the device's cached UC windows, so register pages stay
+ * programmed between calls without this object holding on to any.  Addresses
+ * are relative to base.  Meant for registers, not bulk memory.
+ */
+class RegisterAperture
+{
+    static constexpr uint64_t PAGE_MASK = (1ULL << 21) - 1;
+
+    BlackholePciDevice& device;
+    const uint32_t noc_x;
+    const uint32_t noc_y;
+    const uint64_t base;
+
+public:
+    RegisterAperture(BlackholePciDevice& device, uint32_t noc_x, uint32_t noc_y, uint64_t base = 0)
+        : device(device)
+        , noc_x(noc_x)
+        , noc_y(noc_y)
+        , base(base)
+    {
+    }
+
+    uint32_t read32(uint64_t address)
+    {
+        auto window = device.map_tlb_2M_UC_cached(noc_x, noc_y, base + address);
+        return window->read32(0);
+    }
+
+    void write32(uint64_t address, uint32_t value)
+    {
+        auto window = device.map_tlb_2M_UC_cached(noc_x, noc_y, base + address);
+        window->write32(0, value);
+    }
+
+    /**
+     * @brief Apply reads and writes in order, with one fence at the end
+     * instead of one (or two) per access.
+     *
+     * Consecutive ops in the same 2 MiB page share one window.
+     *
+     * @param ops reads have their value filled in
+     */
+    void apply(std::vector<RegisterOp>& ops)
+    {
+        std::unique_ptr<TlbWindow> window;
+        uint64_t window_page = 0;
+
+        for (auto& op : ops) {
+            const uint64_t address = base + op.address;
+            const uint64_t page = address >> 21;
+            if (!window || page != window_page) {
+                window = device.map_tlb_2M_UC_cached(noc_x, noc_y, page << 21);
+                window_page = page;
+            }
+            const uint64_t offset = address & PAGE_MASK;
+
+            if (op.type == RegisterOp::Type::Write) {
+                window->write32(offset, op.value);
+            } else {
+                op.value = window->read32(offset);
+            }
+        }
+        mfence();
+    }
+};
+
+} // namespace tt
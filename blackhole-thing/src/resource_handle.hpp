@@ -0,0 +1,84 @@
+#pragma once
+
+#include "logger.hpp"
+
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+
+namespace tt {
+
+class BlackholePciDevice;
+
+/**
+ * @brief Base for handles that give something back when they are destroyed
+ * (a TLB entry, an iATU mapping, ...).
+ *
+ * The release function runs once, from the destructor.  If it throws, the
+ * error is logged rather than thrown out of the destructor.  Handles can't be
+ * copied; hand them out in a unique_ptr.
+ */
+class ReleaseOnDestroy
+{
+    std::function<void()> on_destruct;
+
+protected:
+    explicit ReleaseOnDestroy(std::function<void()> release)
+        : on_destruct(std::move(release))
+    {
+    }
+
+    ~ReleaseOnDestroy()
+    {
+        if (!on_destruct) {
+            return;
+        }
+        try {
+            on_destruct();
+        } catch (const std::exception& e) {
+            LOG_ERROR("Failed to release handle: {}", e.what());
+        }
+    }
+
+public:
+    ReleaseOnDestroy(const ReleaseOnDestroy&) = delete;
+    ReleaseOnDestroy& operator=(const ReleaseOnDestroy&) = delete;
+};
+
+/**
+ * @brief One T per (device, tile), shared by everyone who asks for it and
+ * kept alive only by them.
+ *
+ * For bookkeeping that must agree across every object for a tile, e.g. which
+ * of its TLB entries are in use.  Use a function-local static instance.
+ */
+template <typename T> class PerTileRegistry
+{
+    std::mutex mutex;
+    std::map<std::tuple<BlackholePciDevice*, uint32_t, uint32_t>, std::weak_ptr<T>> entries;
+
+public:
+    /**
+     * @param make returns a new std::shared_ptr<T>; called under the
+     * registry's lock when there is no live T for this tile
+     */
+    template <typename Make>
+    std::shared_ptr<T> get(BlackholePciDevice& device, uint32_t noc_x, uint32_t noc_y, Make make)
+    {
+        std::scoped_lock lock(mutex);
+        auto& weak = entries[{&device, noc_x, noc_y}];
+        auto shared = weak.lock();
+        if (!shared) {
+            shared = make();
+            weak = shared;
+        }
+        return shared;
+    }
+};
+
+} // namespace tt
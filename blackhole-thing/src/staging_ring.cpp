@@ -0,0 +1,92 @@
+#include "staging_ring.hpp"
+
+#include "atomic.hpp"
+#include "utility.hpp"
+
+#include <stdexcept>
+#include <thread>
+
+namespace tt {
+
+StagingRing::StagingRing(std::unique_ptr<TlbWindow> wc, std::unique_ptr<TlbWindow> uc, size_t slot_size,
+                         size_t num_slots)
+    : wc(std::move(wc))
+    , uc(std::move(uc))
+    , slot_size(slot_size)
+    , num_slots(num_slots)
+{
+    if (slot_size < 64 || slot_size % 64 != 0) {
+        throw std::invalid_argument("Staging ring slot size must be a multiple of 64");
+    }
+    if (num_slots < 2) {
+        throw std::invalid_argument("Staging ring needs at least two slots");
+    }
+    const size_t total = HEADER_SIZE + slot_size * num_slots;
+    if (total > this->wc->size() || total > this->uc->size()) {
+        throw std::invalid_argument("Staging ring does not fit in its window");
+    }
+
+    this->uc->write32(HEAD, 0);
+    this->uc->write32(TAIL, 0);
+    this->uc->write32(0x4, num_slots);
+    this->uc->write32(0x8, slot_size);
+    this->uc->write32(0x0, MAGIC);
+    mfence();
+}
+
+bool StagingRing::try_post(const void* data, size_t size)
+{
+    if (size > max_message_size()) {
+        throw std::invalid_argument("Message too large for staging ring slot");
+    }
+
+    const uint32_t next = (head + 1) % num_slots;
+    if (next == cached_tail) {
+        cached_tail = read_tail();
+        if (next == cached_tail) {
+            return false;
+        }
+    }
+
+    const uint64_t slot = slot_offset(head);
+    wc->write32(slot, size);
+    wc->write_block(slot + sizeof(uint32_t), data, size);
+
+    // Payload must land before the X280 can see the new head.
+    sfence();
+    uc->write32(HEAD, next);
+    head = next;
+    return true;
+}
+
+void StagingRing::post(const void* data, size_t size, std::chrono::milliseconds timeout)
+{
+    Timer timer;
+    const uint64_t timeout_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+    while (!try_post(data, size)) {
+        if (timer.elapsed_ns() > timeout_ns) {
+            throw std::runtime_error("Timed out waiting for a free staging ring slot");
+        }
+        std::this_thread::yield();
+    }
+}
+
+void StagingRing::drain(std::chrono::milliseconds timeout)
+{
+    Timer timer;
+    const uint64_t timeout_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+    while ((cached_tail = read_tail()) != head) {
+        if (timer.elapsed_ns() > timeout_ns) {
+            throw std::runtime_error("Timed out waiting for the X280 to drain the staging ring");
+        }
+        std::this_thread::yield();
+    }
+}
+
+void StagingRing::discard()
+{
+    uc->write32(TAIL, head);
+    cached_tail = head;
+}
+
+} // namespace tt
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "tlb_window.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+namespace tt {
+
+/**
+ * @brief Single-producer ring of small host-to-X280 messages in X280-visible
+ * memory.
+ *
+ * The host fills slots through a WC window and publishes them by bumping
+ * head through a UC window onto the same memory; the X280 consumes and
+ * bumps tail.  Layout, all little-endian u32:
+ *
+ *   0x000  magic, num_slots, slot_size    written once by the host
+ *   0x040  head                           host
+ *   0x080  tail                           X280
+ *   0x100  slot[num_slots]                each: length, then payload
+ *
+ * head and tail live on their own 64-byte lines so neither side's cache
+ * line bounces on the other's writes.
+ *
+ * Nothing here cares where the memory is.  L2CPU::create_l3_staging_ring
+ * puts it in the L3 zero region, create_dram_staging_ring in X280 DRAM.
+ */
+class StagingRing
+{
+public:
+    static constexpr uint32_t MAGIC = 0x53545247; // "STRG"
+    static constexpr size_t HEADER_SIZE = 0x100;
+
+    // Written to the magic word by the X280 side when memory that needs its
+    // cooperation (the L3 zero region) is ready to hold a ring.
+    static constexpr uint32_t READY = 0x59444552; // "REDY"
+
+    /**
+     * @brief Has the X280 side marked this memory READY, or does it already
+     * hold a ring laid out by an earlier StagingRing?
+     */
+    static bool consumer_ready(TlbWindow& uc)
+    {
+        const uint32_t magic = uc.read32(0x0);
+        return magic == READY || magic == MAGIC;
+    }
+
+    /**
+     * @brief Lay out an empty ring.  Both windows must map the same memory.
+     *
+     * @param slot_size bytes per slot including the length word; a multiple
+     *                  of 64 so each message starts on a cache line
+     * @throws std::invalid_argument if the ring doesn't fit the windows
+     */
+    StagingRing(std::unique_ptr<TlbWindow> wc, std::unique_ptr<TlbWindow> uc, size_t slot_size, size_t num_slots);
+
+    /**
+     * @brief Copy a message into the next slot and publish it.
+     *
+     * @return false if the ring is full (the X280 hasn't caught up)
+     * @throws std::invalid_argument if size exceeds max_message_size()
+     */
+    bool try_post(const void* data, size_t size);
+
+    /**
+     * @brief As try_post, but wait for a free slot.
+     *
+     * @throws std::runtime_error on timeout
+     */
+    void post(const void* data, size_t size, std::chrono::milliseconds timeout = std::chrono::milliseconds(1000));
+
+    /**
+     * @brief Wait for the X280 to consume everything posted so far.
+     *
+     * @throws std::runtime_error on timeout
+     */
+    void drain(std::chrono::milliseconds timeout = std::chrono::milliseconds(1000));
+
+    /**
+     * @brief Mark everything posted as consumed, on the X280's behalf.  For
+     * when nothing is running there, e.g. in benchmarks.
+     */
+    void discard();
+
+    /**
+     * @brief Read head back through the UC window.  The read can't complete
+     * before the writes ahead of it on the NOC, so it returning means the
+     * last post is visible at the far end.
+     */
+    uint32_t read_head() { return uc->read32(HEAD); }
+    uint32_t read_tail() { return uc->read32(TAIL); }
+
+    size_t max_message_size() const { return slot_size - sizeof(uint32_t); }
+    size_t get_num_slots() const { return num_slots; }
+
+private:
+    static constexpr uint64_t HEAD = 0x40;
+    static constexpr uint64_t TAIL = 0x80;
+
+    uint64_t slot_offset(uint32_t index) const { return HEADER_SIZE + index * slot_size; }
+
+    std::unique_ptr<TlbWindow> wc;
+    std::unique_ptr<TlbWindow> uc;
+    const size_t slot_size;
+    const size_t num_slots;
+
+    uint32_t head = 0;
+    uint32_t cached_tail = 0; // last tail read; only re-read when the ring looks full
+};
+
+} // namespace tt
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace tt {
+
+/**
+ * @brief How a TlbEntryAllocator's entries are being used.
+ *
+ * in_use:   referenced by at least one handle
+ * idle:     still programmed with a mapping, but unreferenced; reusable as-is
+ *           by a request for the same target, or retargetable
+ * reserved: taken out of the pool by a caller that manages them by index
+ */
+struct TlbOccupancy
+{
+    size_t total;
+    size_t in_use;
+    size_t idle;
+    size_t reserved;
+};
+
+/**
+ * @brief Bookkeeping for a fixed set of TLB entries that are expensive to
+ * program and worth sharing.
+ *
+ * Each entry remembers the target it was last programmed with (an opaque key
+ * the caller derives from e.g. x, y and address).  acquire() of a key that is
+ * already programmed takes another reference on that entry instead of
+ * programming a new one.  Released entries stay programmed until another
+ * target needs the slot; free entries are used first, then the least recently
+ * released idle one.  Entries in use are never retargeted.
+ *
+ * Programming happens under the allocator's lock, so nobody can see an entry
+ * for a key before it has been programmed with it.
+ */
+class TlbEntryAllocator
+{
+    struct Entry
+    {
+        uint64_t key = 0;
+        bool programmed = false;
+        bool reserved = false;
+        size_t refs = 0;
+        uint64_t last_used = 0;
+    };
+
+    std::mutex mutex;
+    std::vector<Entry> entries;
+    uint64_t clock = 0;
+
+public:
+    using ProgramFn = std::function<void(size_t index)>;
+
+    TlbEntryAllocator(size_t count)
+        : entries(count)
+    {
+    }
+
+    /**
+     * @brief Get an entry programmed for key, taking a reference on it.
+     *
+     * @param program called with the chosen index if it must be (re)programmed
+     * @return entry index
+     * @throws std::runtime_error if every entry is in use or reserved
+     */
+    size_t acquire(uint64_t key, const ProgramFn& program)
+    {
+        std::scoped_lock lock(mutex);
+
+        for (size_t i = 0; i < entries.size(); ++i) {
+            Entry& entry = entries[i];
+            if (entry.programmed && !entry.reserved && entry.key == key) {
+                entry.refs++;
+                return i;
+            }
+        }
+
+        size_t victim = entries.size();
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const Entry& entry = entries[i];
+            if (entry.reserved || entry.refs) {
+                continue;
+            }
+            if (!entry.programmed) {
+                victim = i;
+                break;
+            }
+            if (victim == entries.size() || entry.last_used < entries[victim].last_used) {
+                victim = i;
+            }
+        }
+
+        if (victim == entries.size()) {
+            throw std::runtime_error("No free TLB entries available");
+        }
+
+        Entry& entry = entries[victim];
+        entry.programmed = false; // in case program() throws
+        program(victim);
+        entry.key = key;
+        entry.programmed = true;
+        entry.refs = 1;
+        return victim;
+    }
+
+    /**
+     * @brief Drop a reference taken by acquire().  The entry stays programmed.
+     */
+    void release(size_t index)
+    {
+        std::scoped_lock lock(mutex);
+        Entry& entry = entries.at(index);
+        if (entry.refs == 0) {
+            throw std::logic_error("TLB entry released too many times");
+        }
+        entry.refs--;
+        entry.last_used = ++clock;
+    }
+
+    /**
+     * @brief Take an entry out of the pool for good, for callers that program
+     * entries by index themselves.
+     *
+     * @throws std::runtime_error if a handle is using the entry
+     */
+    void reserve(size_t index)
+    {
+        std::scoped_lock lock(mutex);
+        Entry& entry = entries.at(index);
+        if (entry.refs) {
+            throw std::runtime_error("TLB entry is in use by the allocator");
+        }
+        entry.reserved = true;
+        entry.programmed = false;
+    }
+
+    TlbOccupancy occupancy()
+    {
+        std::scoped_lock lock(mutex);
+        TlbOccupancy result{entries.size(), 0, 0, 0};
+        for (const auto& entry : entries) {
+            if (entry.reserved) {
+                result.reserved++;
+            } else if (entry.refs) {
+                result.in_use++;
+            } else if (entry.programmed) {
+                result.idle++;
+            }
+        }
+        return result;
+    }
+};
+
+} // namespace tt
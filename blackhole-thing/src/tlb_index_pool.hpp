@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+namespace tt {
+
+/**
+ * @brief Lock-free pool of TLB indices.
+ *
+ * A bitmap with one bit per index, set when the index is free.  Allocation
+ * claims a set bit with a CAS; release sets it again with a fetch_or.
+ *
+ * The bitmap is striped: index i lives in word (i % num_words), and each word
+ * has a cache line to itself.  Threads start scanning at a word derived from
+ * their thread id, so a dozen threads pulling windows at once mostly touch
+ * different cache lines instead of piling onto one mutex.
+ */
+class TlbIndexPool
+{
+    static constexpr size_t MAX_WORDS = 16;
+
+    struct alignas(64) Word
+    {
+        std::atomic<uint64_t> bits{0};
+    };
+
+    const size_t first;
+    const size_t count;
+    const size_t num_words;
+    std::unique_ptr<Word[]> words;
+
+    size_t home_word() const
+    {
+        static thread_local const size_t hash = std::hash<std::thread::id>{}(std::this_thread::get_id());
+        return hash % num_words;
+    }
+
+public:
+    /**
+     * @brief Construct a pool where every index is free.
+     *
+     * @param first lowest index in the pool
+     * @param count number of indices in the pool
+     */
+    TlbIndexPool(size_t first, size_t count)
+        : first(first)
+        , count(count)
+        , num_words(std::min(count, MAX_WORDS))
+        , words(std::make_unique<Word[]>(num_words))
+    {
+        if (count == 0 || count > num_words * 64) {
+            throw std::invalid_argument("Bad TLB index pool size");
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            words[i % num_words].bits.fetch_or(1ULL << (i / num_words), std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Claim a free index.
+     *
+     * @return the index, or nothing if every index is in use
+     */
+    std::optional<size_t> allocate()
+    {
+        const size_t home = home_word();
+
+        for (size_t n = 0; n < num_words; ++n) {
+            const size_t w = (home + n) % num_words;
+            auto& bits = words[w].bits;
+            uint64_t old_bits = bits.load(std::memory_order_relaxed);
+
+            while (old_bits != 0) {
+                const uint64_t new_bits = old_bits & (old_bits - 1); // clear lowest set bit
+                if (bits.compare_exchange_weak(old_bits, new_bits, std::memory_order_acquire,
+                                               std::memory_order_relaxed)) {
+                    const size_t bit = __builtin_ctzll(old_bits);
+                    return first + w + (bit * num_words);
+                }
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Return an index previously obtained from allocate().
+     *
+     * @param index which index
+     */
+    void release(size_t index)
+    {
+        const size_t i = index - first;
+        words[i % num_words].bits.fetch_or(1ULL << (i / num_words), std::memory_order_release);
+    }
+
+    /**
+     * @brief Number of free indices.  Only a snapshot under concurrency.
+     */
+    size_t available() const
+    {
+        size_t n = 0;
+        for (size_t w = 0; w < num_words; ++w) {
+            n += __builtin_popcountll(words[w].bits.load(std::memory_order_relaxed));
+        }
+        return n;
+    }
+
+    size_t capacity() const
+    {
+        return count;
+    }
+};
+
+} // namespace tt
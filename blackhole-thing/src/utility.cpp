@@ -1,6 +1,10 @@
 #include "utility.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
+#include <stdexcept>
 
 namespace tt {
 
@@ -24,4 +28,77 @@ void write_file(const std::string& filename, const void* data, size_t size)
     file.write(reinterpret_cast<const char*>(data), size);
 }
 
+std::string device_path()
+{
+    const char* path = std::getenv("TT_DEVICE");
+    return path ? path : "/dev/tenstorrent/0";
+}
+
+void parse_command_line(int argc, char** argv, const std::vector<std::string>& flags,
+                        const std::function<bool(const std::string& option, const std::string& value)>& handle,
+                        void (*usage)(const char* argv0))
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            std::exit(0);
+        }
+
+        std::string value;
+        if (std::find(flags.begin(), flags.end(), arg) == flags.end()) {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+                std::exit(1);
+            }
+            value = argv[++i];
+        }
+
+        bool ok;
+        try {
+            ok = handle(arg, value);
+        } catch (const std::logic_error&) {
+            ok = false; // std::stoull and friends
+        }
+
+        if (!ok) {
+            usage(argv[0]);
+            std::exit(1);
+        }
+    }
+}
+
+bool parse_xy(const std::string& value, uint32_t& x, uint32_t& y)
+{
+    return std::sscanf(value.c_str(), "%u,%u", &x, &y) == 2;
+}
+
+std::vector<size_t> size_sweep(size_t first, size_t last, size_t factor)
+{
+    std::vector<size_t> sizes;
+    for (size_t size = first; size < last; size *= factor) {
+        sizes.push_back(size);
+    }
+    sizes.push_back(last);
+    return sizes;
+}
+
+uint64_t median_ns(size_t trials, const std::function<void()>& fn)
+{
+    if (trials == 0) {
+        throw std::invalid_argument("median_ns: trials must be nonzero");
+    }
+
+    fn(); // warm up
+
+    std::vector<uint64_t> samples;
+    for (size_t i = 0; i < trials; ++i) {
+        Timer timer;
+        fn();
+        samples.push_back(timer.elapsed_ns());
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
 } // namespace tt
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include <functional>
 #include <random>
 #include <string>
 #include <vector>
@@ -12,6 +13,44 @@ namespace tt {
 void write_file(const std::string& filename, const void* data, size_t size);
 std::vector<uint8_t> read_file(const std::string& filename);
 
+/**
+ * @brief Device for tools and benchmarks to open: $TT_DEVICE if set (e.g.
+ * "emulated"), otherwise /dev/tenstorrent/0.
+ */
+std::string device_path();
+
+/**
+ * @brief The command-line loop the tools share.
+ *
+ * Options are "--name VALUE" unless listed in flags, which take no value and
+ * reach handle with an empty one.  handle returns false for an unknown option
+ * or a bad value.  -h/--help prints usage and exits 0.  A missing value, a
+ * false return, or a number std::stoull etc. can't parse prints usage and
+ * exits 1.
+ */
+void parse_command_line(int argc, char** argv, const std::vector<std::string>& flags,
+                        const std::function<bool(const std::string& option, const std::string& value)>& handle,
+                        void (*usage)(const char* argv0));
+
+/**
+ * @brief Parse "X,Y" NOC coordinates.
+ */
+bool parse_xy(const std::string& value, uint32_t& x, uint32_t& y);
+
+/**
+ * @brief Sizes for a benchmark sweep: first, first * factor, ... while below
+ * last, then always last itself.
+ */
+std::vector<size_t> size_sweep(size_t first, size_t last, size_t factor);
+
+/**
+ * @brief Run fn once to warm up, then time it trials times.
+ *
+ * @return the median, in nanoseconds
+ * @throws std::invalid_argument if trials is 0
+ */
+uint64_t median_ns(size_t trials, const std::function<void()>& fn);
+
 template <typename T> T random_integer()
 {
     static std::random_device rd;
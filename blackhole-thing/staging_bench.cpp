@@ -0,0 +1,144 @@
+#include "blackhole_pcie.hpp"
+#include "l2cpu_core.hpp"
+#include "staging_ring.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+
+using namespace tt;
+
+static constexpr uint32_t L2CPU_X = 8;
+static constexpr uint32_t L2CPU_Y = 3;
+
+struct Options
+{
+    uint32_t x = L2CPU_X;
+    uint32_t y = L2CPU_Y;
+    uint64_t dram_offset = L2CPU::BENCH_SCRATCH_OFFSET;
+    size_t samples = 1000;
+    size_t slot_size = 256;
+    bool consume = false;
+};
+
+static void usage(const char* argv0)
+{
+    fmt::print("Usage: {} [options]\n", argv0);
+    fmt::print("  Compares posting small messages to the X280 through a staging ring in the L3\n");
+    fmt::print("  zero region against the same ring in X280 DRAM (the path x280-net uses).  The L3\n");
+    fmt::print("  ring is skipped unless the X280 side has marked the zero region ready.\n\n");
+    fmt::print("  --l2cpu X,Y         L2CPU tile (default {},{})\n", L2CPU_X, L2CPU_Y);
+    fmt::print("  --dram OFFSET       DRAM ring offset into X280 DRAM (default {:#x})\n",
+               L2CPU::BENCH_SCRATCH_OFFSET);
+    fmt::print("  --samples N         messages per size (default 1000)\n");
+    fmt::print("  --slot-size BYTES   ring slot size, multiple of 64 (default 256)\n");
+    fmt::print("  --consume           also time until the X280 consumes each message (needs a\n");
+    fmt::print("                      consumer running on the X280)\n");
+}
+
+static Options parse_options(int argc, char** argv)
+{
+    Options options;
+
+    parse_command_line(argc, argv, {"--consume"}, [&](const std::string& arg, const std::string& value) {
+        if (arg == "--consume") {
+            options.consume = true;
+        } else if (arg == "--l2cpu") {
+            return parse_xy(value, options.x, options.y);
+        } else if (arg == "--dram") {
+            options.dram_offset = std::stoull(value, nullptr, 0);
+        } else if (arg == "--samples") {
+            options.samples = std::max<size_t>(1, std::stoull(value));
+        } else if (arg == "--slot-size") {
+            options.slot_size = std::stoull(value, nullptr, 0);
+        } else {
+            return false;
+        }
+        return true;
+    }, usage);
+
+    return options;
+}
+
+struct Latency
+{
+    std::vector<uint64_t> samples;
+
+    uint64_t percentile(size_t p)
+    {
+        std::sort(samples.begin(), samples.end());
+        return samples[std::min(samples.size() - 1, samples.size() * p / 100)];
+    }
+};
+
+// post:     until the host has handed the message off (WC writes + head)
+// visible:  post, then a UC read of head, which returns only after the
+//           message is at the far end
+// consumed: post, then wait for the X280 to advance tail
+static void run(const char* name, StagingRing& ring, const Options& options)
+{
+    std::vector<uint8_t> message(ring.max_message_size(), 0xa5);
+
+    for (size_t size : {8, 64, 128, 252, 1020}) {
+        if (size > ring.max_message_size()) {
+            continue;
+        }
+
+        Latency post;
+        Latency visible;
+        Latency consumed;
+        for (size_t i = 0; i < options.samples; ++i) {
+            if (!options.consume) {
+                // Nobody is consuming; keep the ring from filling up.
+                ring.discard();
+            }
+
+            Timer timer;
+            ring.post(message.data(), size);
+            post.samples.push_back(timer.elapsed_ns());
+            ring.read_head();
+            visible.samples.push_back(timer.elapsed_ns());
+            if (options.consume) {
+                ring.drain();
+                consumed.samples.push_back(timer.elapsed_ns());
+            }
+        }
+
+        fmt::print("{:<5} {:>5}  {:>8} {:>8}  {:>8} {:>8}", name, size, post.percentile(50), post.percentile(99),
+                   visible.percentile(50), visible.percentile(99));
+        if (options.consume) {
+            fmt::print("  {:>8} {:>8}", consumed.percentile(50), consumed.percentile(99));
+        }
+        fmt::print("\n");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options = parse_options(argc, argv);
+
+    BlackholePciDevice device(device_path());
+    L2CPU l2cpu(device, options.x, options.y);
+
+    fmt::print("{:<5} {:>5}  {:>8} {:>8}  {:>8} {:>8}", "ring", "bytes", "post", "p99", "visible", "p99");
+    if (options.consume) {
+        fmt::print("  {:>8} {:>8}", "consumed", "p99");
+    }
+    fmt::print("   (ns)\n");
+
+    try {
+        auto l3 = l2cpu.create_l3_staging_ring(options.slot_size);
+        run("L3", *l3, options);
+    } catch (const std::runtime_error& e) {
+        fmt::print("L3    skipped: {}\n", e.what());
+    }
+
+    auto dram = l2cpu.create_dram_staging_ring(options.dram_offset, options.slot_size);
+    run("DRAM", *dram, options);
+
+    return 0;
+}
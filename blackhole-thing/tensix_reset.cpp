@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <array>
+#include <string>
 #include "fmt/format.h"
 
 using namespace tt;
@@ -60,10 +61,44 @@ public:
     }
 };
 
+// The Tensix grid is two rectangles either side of the DRAM/L2CPU columns.
+struct TensixRectangle
+{
+    xy_t start, end;
+};
+static constexpr std::array<TensixRectangle, 2> TENSIX_RECTANGLES = {
+    TensixRectangle{{1, 2}, {7, 11}},
+    TensixRectangle{{10, 2}, {16, 11}},
+};
+
+// Write the soft reset register of every Tensix with one write per rectangle
+// instead of one TLB reprogram plus one write per core.
+void multicast_soft_reset(BlackholePciDevice& device, uint32_t reset_value)
+{
+    for (const auto& rect : TENSIX_RECTANGLES) {
+        auto options = TlbOptions::multicast_from(rect.start.x, rect.start.y);
+        auto window = device.map_tlb_2M_UC(rect.end.x, rect.end.y, 0xFFB121B0, options);
+
+        fmt::println("Multicast reset to tensix ({}, {})-({}, {}): {:#x}", rect.start.x, rect.start.y, rect.end.x,
+                     rect.end.y, reset_value);
+
+        window->write32(0, reset_value);
+    }
+}
+
 int main(int argc, char** argv)
 {
     BlackholePciDevice device("/dev/tenstorrent/0");
 
+    if (argc > 1 && std::string(argv[1]) == "--multicast") {
+        uint32_t assert_value = BRISC_SOFT_RESET | TRISC_SOFT_RESETS | NCRISC_SOFT_RESET;
+        uint32_t deassert_value = NCRISC_SOFT_RESET | STAGGERED_START_ENABLE;
+        multicast_soft_reset(device, assert_value);
+        multicast_soft_reset(device, deassert_value);
+        multicast_soft_reset(device, assert_value);
+        return 0;
+    }
+
     for (const auto& loc : tensix_locations) {
         std::cout << "Trying location (" << loc.x << ", " << loc.y << ")" << std::endl;
         Tensix tensix(device, loc.x, loc.y);
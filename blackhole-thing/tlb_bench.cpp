@@ -0,0 +1,177 @@
+#include "blackhole_grid.hpp"
+#include "blackhole_pcie.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fmt/core.h"
+
+using namespace tt;
+
+// Any tile will do; nothing is read or written through the windows.
+static constexpr size_t DRAM_X = 9;
+static constexpr size_t DRAM_Y = 6;
+
+static constexpr uint64_t DURATION_NS = 500'000'000;
+
+struct Result
+{
+    uint64_t maps;
+    uint64_t exhausted; // map attempts that found the pool empty
+};
+
+// Each thread maps and unmaps windows as fast as it can for DURATION_NS.
+template <class MapFn> static std::vector<Result> run(size_t num_threads, MapFn map)
+{
+    std::vector<Result> results(num_threads);
+    std::vector<std::thread> threads;
+    std::atomic<bool> go{false};
+
+    for (size_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back([&, i]() {
+            Result& result = results[i];
+            uint64_t address = i << 21;
+
+            while (!go.load(std::memory_order_acquire)) {
+            }
+
+            Timer timer;
+            while (timer.elapsed_ns() < DURATION_NS) {
+                try {
+                    auto window = map(DRAM_X, DRAM_Y, address);
+                    result.maps++;
+                } catch (const std::runtime_error&) {
+                    result.exhausted++;
+                }
+            }
+        });
+    }
+
+    go.store(true, std::memory_order_release);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    return results;
+}
+
+template <class MapFn> static void sweep(const char* name, size_t max_threads, MapFn map)
+{
+    fmt::print("{}\n", name);
+    fmt::print("{:>8} {:>14} {:>14} {:>12}\n", "threads", "maps/s", "maps/s/thread", "exhausted");
+
+    for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        auto results = run(num_threads, map);
+        uint64_t maps = 0;
+        uint64_t exhausted = 0;
+
+        for (const auto& result : results) {
+            maps += result.maps;
+            exhausted += result.exhausted;
+        }
+
+        double rate = maps / (DURATION_NS / 1e9);
+        fmt::print("{:>8} {:>14.0f} {:>14.0f} {:>12}\n", num_threads, rate, rate / num_threads, exhausted);
+    }
+    fmt::print("\n");
+}
+
+// Scatter workload: read one word from every Tensix.  Compares paying for a
+// TLB reprogram per tile against the read alone.
+static constexpr uint64_t SCATTER_ADDRESS = 0; // Tensix L1
+static constexpr size_t SCATTER_ROUNDS = 100;
+
+template <class RoundFn> static void time_scatter(const char* name, RoundFn round)
+{
+    const size_t tiles = Blackhole::TENSIX_LOCATIONS.size();
+
+    round(); // warm up
+
+    Timer timer;
+    for (size_t i = 0; i < SCATTER_ROUNDS; ++i) {
+        round();
+    }
+    double ns_per_tile = timer.elapsed_ns() / double(SCATTER_ROUNDS * tiles);
+
+    fmt::print("{:<32} {:>10.0f} ns/tile\n", name, ns_per_tile);
+}
+
+static void scatter(BlackholePciDevice& device)
+{
+    // Windows are UC, and there are only 13 of them, so work in batches.
+    const size_t batch_size = 8;
+    const auto& tiles = Blackhole::TENSIX_LOCATIONS;
+    volatile uint32_t sink = 0;
+
+    fmt::print("Scatter read32 across {} Tensix tiles\n", tiles.size());
+
+    // Data cost only: windows programmed once, outside the timed region.
+    std::vector<std::unique_ptr<TlbWindow>> windows;
+    for (size_t i = 0; i < batch_size; ++i) {
+        windows.push_back(device.map_tlb_2M_UC(tiles[i].x, tiles[i].y, SCATTER_ADDRESS));
+    }
+    time_scatter("read32 only", [&]() {
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            sink = windows[i % batch_size]->read32(0);
+        }
+    });
+    windows.clear();
+
+    // Reprogram cost only: program a window per tile, never touch it.
+    time_scatter("map_tlb_2M_UC only", [&]() {
+        for (const auto& tile : tiles) {
+            auto window = device.map_tlb_2M_UC(tile.x, tile.y, SCATTER_ADDRESS);
+        }
+    });
+
+    time_scatter("map_tlb_2M_UC + read32", [&]() {
+        for (const auto& tile : tiles) {
+            auto window = device.map_tlb_2M_UC(tile.x, tile.y, SCATTER_ADDRESS);
+            sink = window->read32(0);
+        }
+    });
+
+    time_scatter("map_tlbs_2M_UC + read32", [&]() {
+        for (size_t i = 0; i < tiles.size(); i += batch_size) {
+            std::vector<TlbTarget> targets;
+            for (size_t j = i; j < std::min(i + batch_size, tiles.size()); ++j) {
+                targets.push_back({tiles[j].x, tiles[j].y, SCATTER_ADDRESS});
+            }
+            for (const auto& window : device.map_tlbs_2M_UC(targets)) {
+                sink = window->read32(0);
+            }
+        }
+    });
+
+    time_scatter("map_tlb_2M_UC_cached + read32", [&]() {
+        for (const auto& tile : tiles) {
+            sink = device.map_tlb_2M_UC_cached(tile.x, tile.y, SCATTER_ADDRESS)->read32(0);
+        }
+    });
+
+    fmt::print("\n");
+}
+
+int main(int argc, char** argv)
+{
+    size_t max_threads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+    BlackholePciDevice device(device_path());
+
+    scatter(device);
+
+    sweep("map_tlb_2M_WC", max_threads, [&](uint32_t x, uint32_t y, uint64_t addr) {
+        return device.map_tlb_2M_WC(x, y, addr);
+    });
+    sweep("map_tlb_2M_UC", max_threads, [&](uint32_t x, uint32_t y, uint64_t addr) {
+        return device.map_tlb_2M_UC(x, y, addr);
+    });
+    sweep("map_tlb_4G", max_threads, [&](uint32_t x, uint32_t y, uint64_t addr) {
+        return device.map_tlb_4G(x, y, addr);
+    });
+
+    return 0;
+}
@@ -1,19 +1,29 @@
 
+#include "atomic.hpp"
 #include "blackhole_pcie.hpp"
+#include "utility.hpp"
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <string>
+
 #define X280_MAGIC 0x58323830 /* "X280" in ASCII hex */
 #define MAX_PACKET_SIZE ETH_FRAME_LEN
 #define NUM_PACKETS 650
@@ -132,9 +142,175 @@ static int tun_alloc(char* dev)
     return fd;
 }
 
+/*
+ * Event loop knobs.
+ *
+ * After any traffic the bridge busy-polls both directions for busy_us, which
+ * keeps forwarding latency at one loop iteration (a PCIe read plus a read()
+ * on the TAP fd).  Once that budget runs out with nothing moving, it blocks
+ * in ppoll() on the TAP fd: host->X280 packets wake it immediately, and
+ * X280->host packets are noticed when the timer fires.  The timer starts at
+ * idle_us and doubles on every quiet wakeup up to idle_max_us, so a bridge
+ * that stays idle does next to nothing.  There is no X280->host interrupt to
+ * wait on, so the timer is the only way to hear from the X280 while blocked.
+ * Replies to host traffic normally arrive inside the busy window anyway.
+ */
+struct Options
+{
+    uint64_t busy_us = 100;
+    uint64_t idle_us = 1000;
+    uint64_t idle_max_us = 20000;
+    uint64_t stats_s = 10;
+};
+
+static void usage(const char* argv0)
+{
+    printf("Usage: %s [options]\n", argv0);
+    printf("  --busy-us N     busy-poll for N us after the last packet (default 100)\n");
+    printf("  --idle-us N     when idle, block on the TAP fd and check the X280 after N us\n");
+    printf("                  (default 1000), doubling while nothing arrives...\n");
+    printf("  --idle-max-us N ...up to N us (default 20000); bounds the added X280->host\n");
+    printf("                  latency when idle\n");
+    printf("  --stats S       print CPU usage and latency every S seconds, 0 for never\n");
+    printf("                  (default 10)\n");
+}
+
+static Options parse_options(int argc, char** argv)
+{
+    Options options;
+
+    parse_command_line(argc, argv, {}, [&](const std::string& arg, const std::string& text) {
+        const uint64_t value = std::stoull(text);
+        if (arg == "--busy-us") {
+            options.busy_us = value;
+        } else if (arg == "--idle-us") {
+            options.idle_us = std::max<uint64_t>(1, value);
+        } else if (arg == "--idle-max-us") {
+            options.idle_max_us = std::max<uint64_t>(1, value);
+        } else if (arg == "--stats") {
+            options.stats_s = value;
+        } else {
+            return false;
+        }
+        return true;
+    }, usage);
+
+    return options;
+}
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int)
+{
+    stop = 1;
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1'000'000'000ULL + ts.tv_nsec;
+}
+
+static uint64_t cpu_ns()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1'000'000'000ULL +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1'000ULL;
+}
+
+// The ring indices live in X280 DRAM; every access is a PCIe transaction.
+static uint32_t read_index(const uint32_t* index)
+{
+    return *reinterpret_cast<const volatile uint32_t*>(index);
+}
+
+static void write_index(uint32_t* index, uint32_t value)
+{
+    *reinterpret_cast<volatile uint32_t*>(index) = value;
+}
+
+/*
+ * Per reporting interval.  X280->host packets can only be seen when the host
+ * checks x280_tx_head, so the time since the previous check is how late the
+ * bridge was in noticing them, at worst.  Host->X280 packets wake the loop
+ * directly and aren't measured.
+ *
+ * Notice times go in a fixed histogram, one bucket per power of two of ns,
+ * so nothing grows when stats are never reported; p50 is to within 2x.
+ */
+struct Stats
+{
+    uint64_t start_ns = now_ns();
+    uint64_t start_cpu_ns = cpu_ns();
+    uint64_t blocked_ns = 0;
+    uint64_t to_x280 = 0;
+    uint64_t to_x280_dropped = 0;
+    uint64_t from_x280 = 0;
+    uint64_t from_x280_dropped = 0;
+    uint64_t notices = 0;
+    uint64_t notice_buckets[64] = {}; // [i] counts notice times in [2^i, 2^(i+1)) ns
+    uint64_t notice_max_ns = 0;
+
+    void notice(uint64_t ns)
+    {
+        notice_buckets[ns ? 63 - __builtin_clzll(ns) : 0]++;
+        notice_max_ns = std::max(notice_max_ns, ns);
+        notices++;
+    }
+
+    void report()
+    {
+        const uint64_t wall = now_ns() - start_ns;
+        const double cpu = 100.0 * (cpu_ns() - start_cpu_ns) / wall;
+        const double blocked = 100.0 * blocked_ns / wall;
+
+        uint64_t p50 = 0;
+        for (uint64_t i = 0, seen = 0; notices && i < 64; ++i) {
+            seen += notice_buckets[i];
+            if (seen > notices / 2) {
+                p50 = std::min<uint64_t>(notice_max_ns, (2ULL << i) - 1);
+                break;
+            }
+        }
+
+        printf("cpu %5.1f%%  blocked %5.1f%%  to_x280 %lu (dropped %lu)  from_x280 %lu (dropped %lu)  "
+               "added latency p50 <%.1f us max %.1f us\n",
+               cpu, blocked, to_x280, to_x280_dropped, from_x280, from_x280_dropped, p50 / 1e3,
+               notice_max_ns / 1e3);
+        fflush(stdout);
+
+        *this = Stats();
+    }
+};
+
+/*
+ * The TAP fd is nonblocking, so a full TAP queue shows up as EAGAIN.  Give the
+ * kernel up to TAP_WRITE_WAIT_MS to make room, then drop the packet, as a NIC
+ * would; stalling longer would stall the host->X280 direction too.
+ */
+static constexpr int TAP_WRITE_WAIT_MS = 1;
+
+static bool write_packet(int fd, const void* data, size_t len)
+{
+    ssize_t written = write(fd, data, len);
+    if (written < 0 && (errno == EAGAIN || errno == EINTR)) {
+        struct pollfd pfd = {.fd = fd, .events = POLLOUT, .revents = 0};
+        if (poll(&pfd, 1, TAP_WRITE_WAIT_MS) > 0) {
+            written = write(fd, data, len);
+        }
+    }
+    if (written < 0 && errno != EAGAIN && errno != EINTR) {
+        perror("write");
+    }
+    return written >= 0;
+}
+
 int main(int argc, char* argv[])
 {
-    BlackholePciDevice device("/dev/tenstorrent/0");
+    Options options = parse_options(argc, argv);
+    BlackholePciDevice device(device_path());
 
     // TODO: stop using 4G windows for this.  I'm using them out of laziness: I
     // don't have an effective way to pick an unused 2M window, and I don't want
@@ -142,12 +318,9 @@ int main(int argc, char* argv[])
     // a 4G window, so this will work for now.  If this were real code...
     auto window = device.map_tlb_4G(L2CPU_X, L2CPU_Y, X280_NET_BUFFERS);
     auto interrupt = device.map_tlb_4G(L2CPU_X, L2CPU_Y, X280_REGS);
-    // volatile uint8_t* p = window->as<volatile uint8_t*>();
     auto shmem = window->as<x280_shmem_layout*>();
-    // struct x280_shmem_layout *shmem = (struct x280_shmem_layout *)p;
     char tun_name[IFNAMSIZ] = "tap0";
     int tun_fd;
-    fd_set readfds;
     char buffer[MAX_PACKET_SIZE];
 
     if (shmem->magic != X280_MAGIC) {
@@ -164,53 +337,124 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    printf("Created TAP interface %s\n", tun_name);
+    // Drain the TAP fd with read() until EAGAIN; block in ppoll() instead.
+    fcntl(tun_fd, F_SETFL, fcntl(tun_fd, F_GETFL) | O_NONBLOCK);
 
-    while (1) {
-        FD_ZERO(&readfds);
-        FD_SET(tun_fd, &readfds);
+    struct sigaction action = {};
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
 
-        struct timeval tv = {
-            .tv_sec = 0,
-            .tv_usec = 1,
-        };
+    printf("Created TAP interface %s\n", tun_name);
 
-        if (select(tun_fd + 1, &readfds, NULL, NULL, &tv) < 0) {
-            perror("select");
-            break;
+    // The host owns rx_head and tx_tail, so it never has to read them back.
+    // rx_tail is only re-read when the ring looks full.
+    uint32_t rx_head = read_index(&shmem->x280_rx_head);
+    uint32_t rx_tail = read_index(&shmem->x280_rx_tail);
+    uint32_t tx_tail = read_index(&shmem->x280_tx_tail);
+
+    const uint64_t busy_ns = options.busy_us * 1'000;
+    const uint64_t stats_ns = options.stats_s * 1'000'000'000ULL;
+    const uint64_t idle_max_us = std::max(options.idle_us, options.idle_max_us);
+    uint64_t idle_us = options.idle_us;
+
+    Stats stats;
+    uint64_t last_traffic_ns = now_ns();
+    uint64_t last_check_ns = now_ns();
+
+    while (!stop) {
+        if (now_ns() - last_traffic_ns >= busy_ns) {
+            struct pollfd pfd = {.fd = tun_fd, .events = POLLIN, .revents = 0};
+            const struct timespec idle_timeout = {
+                .tv_sec = time_t(idle_us / 1'000'000),
+                .tv_nsec = long(idle_us % 1'000'000) * 1'000,
+            };
+            const uint64_t blocked_from = now_ns();
+            if (ppoll(&pfd, 1, &idle_timeout, NULL) < 0 && errno != EINTR) {
+                perror("ppoll");
+                break;
+            }
+            stats.blocked_ns += now_ns() - blocked_from;
+            idle_us = std::min(idle_us * 2, idle_max_us);
         }
 
-        /* Check for packets from TAP */
-        if (FD_ISSET(tun_fd, &readfds)) {
+        bool moved = false;
+
+        /* Packets from TAP: all that are queued, then one interrupt */
+        bool posted = false;
+        for (;;) {
             ssize_t len = read(tun_fd, buffer, sizeof(buffer));
             if (len < 0) {
-                perror("read");
+                if (errno != EAGAIN && errno != EINTR) {
+                    perror("read");
+                    stop = 1;
+                }
                 break;
             }
+            moved = true;
 
-            uint32_t next_head = (shmem->x280_rx_head + 1) % NUM_PACKETS;
-            if (next_head != shmem->x280_rx_tail) {
-                shmem->x280_rx[shmem->x280_rx_head].len = len;
-                memcpy(shmem->x280_rx[shmem->x280_rx_head].data, buffer, len);
-                __atomic_thread_fence(__ATOMIC_RELEASE);
-                shmem->x280_rx_head = next_head;
-                interrupt->write32(0x404, 1 << 27);
+            uint32_t next_head = (rx_head + 1) % NUM_PACKETS;
+            if (next_head == rx_tail) {
+                rx_tail = read_index(&shmem->x280_rx_tail);
+            }
+            if (next_head == rx_tail) {
+                stats.to_x280_dropped++;
+                continue;
             }
+
+            shmem->x280_rx[rx_head].len = len;
+            memcpy(shmem->x280_rx[rx_head].data, buffer, len);
+            // The window is write-combining: drain the payload before the
+            // head that publishes it.
+            sfence();
+            rx_head = next_head;
+            write_index(&shmem->x280_rx_head, rx_head);
+            posted = true;
+            stats.to_x280++;
+        }
+        if (posted) {
+            sfence(); // and the last head before the doorbell
+            interrupt->write32(0x404, 1 << 27);
         }
 
-        /* Check for packets from X280 */
-        while (shmem->x280_tx_tail != shmem->x280_tx_head) {
-            struct packet* pkt = &shmem->x280_tx[shmem->x280_tx_tail];
-            if (pkt->len > 0 && pkt->len <= MAX_PACKET_SIZE) {
-                if (write(tun_fd, pkt->data, pkt->len) < 0) {
-                    printf("Failed writing packet\n");
+        /* Packets from X280: one read of head, one write of tail */
+        const uint32_t tx_head = read_index(&shmem->x280_tx_head);
+        const uint64_t checked_ns = now_ns();
+        if (tx_head != tx_tail) {
+            stats.notice(checked_ns - last_check_ns);
+            moved = true;
+        }
+        last_check_ns = checked_ns;
+
+        const bool received = tx_head != tx_tail;
+        while (tx_tail != tx_head) {
+            struct packet* pkt = &shmem->x280_tx[tx_tail];
+            uint32_t len = pkt->len;
+            if (len > 0 && len <= MAX_PACKET_SIZE) {
+                if (write_packet(tun_fd, pkt->data, len)) {
+                    stats.from_x280++;
+                } else {
+                    stats.from_x280_dropped++;
                 }
             }
-            shmem->x280_tx_tail = (shmem->x280_tx_tail + 1) % NUM_PACKETS;
+            tx_tail = (tx_tail + 1) % NUM_PACKETS;
+        }
+        if (received) {
+            write_index(&shmem->x280_tx_tail, tx_tail);
+        }
+        if (moved) {
+            last_traffic_ns = now_ns();
+            idle_us = options.idle_us;
+        }
+
+        if (stats_ns && now_ns() - stats.start_ns >= stats_ns) {
+            stats.report();
         }
     }
 
-out:
+    if (stats_ns) {
+        stats.report();
+    }
     close(tun_fd);
     return 0;
-}
\ No newline at end of file
+}
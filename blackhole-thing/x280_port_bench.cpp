@@ -0,0 +1,129 @@
+#include "atomic.hpp"
+#include "blackhole_pcie.hpp"
+#include "l2cpu_core.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+
+using namespace tt;
+
+static constexpr uint32_t L2CPU_X = 8;
+static constexpr uint32_t L2CPU_Y = 3;
+
+struct Options
+{
+    uint32_t x = L2CPU_X;
+    uint32_t y = L2CPU_Y;
+    uint64_t dram_offset = L2CPU::BENCH_SCRATCH_OFFSET;
+    size_t trials = 20;
+    size_t max_size = 1ULL << 20;
+};
+
+static void usage(const char* argv0)
+{
+    fmt::print("Usage: {} [options]\n", argv0);
+    fmt::print("  Compares host access to X280 DRAM through the memory port (coherent) and the\n");
+    fmt::print("  system port (non-coherent, plus the cost of flushing X280 caches).\n\n");
+    fmt::print("  --l2cpu X,Y         L2CPU tile (default {},{})\n", L2CPU_X, L2CPU_Y);
+    fmt::print("  --dram OFFSET       2 MiB scratch area in X280 DRAM, overwritten (default {:#x})\n",
+               L2CPU::BENCH_SCRATCH_OFFSET);
+    fmt::print("  --trials N          timed repetitions per case (default 20)\n");
+    fmt::print("  --max-size BYTES    largest bulk transfer (default 1 MiB, at most 2 MiB)\n");
+}
+
+static Options parse_options(int argc, char** argv)
+{
+    Options options;
+
+    parse_command_line(argc, argv, {}, [&](const std::string& arg, const std::string& value) {
+        if (arg == "--l2cpu") {
+            return parse_xy(value, options.x, options.y);
+        } else if (arg == "--dram") {
+            options.dram_offset = std::stoull(value, nullptr, 0);
+        } else if (arg == "--trials") {
+            options.trials = std::max<size_t>(1, std::stoull(value));
+        } else if (arg == "--max-size") {
+            options.max_size = std::min<size_t>(1ULL << 21, std::stoull(value, nullptr, 0));
+        } else {
+            return false;
+        }
+        return true;
+    }, usage);
+
+    return options;
+}
+
+static void report(const char* mode, const char* op, size_t size, uint64_t ns)
+{
+    double mib_per_sec = ns ? (size / (1024.0 * 1024.0)) / (ns / 1e9) : 0.0;
+    fmt::print("{:<12} {:<20} {:>8} {:>10} {:>10.1f}\n", mode, op, size, ns, mib_per_sec);
+}
+
+static void run(L2CPU& l2cpu, X280Access access, const Options& options)
+{
+    const bool coherent = access == X280Access::Coherent;
+    const char* mode = coherent ? "coherent" : "noncoherent";
+    const uint64_t offset = options.dram_offset;
+
+    auto uc = l2cpu.map_dram_2M_UC(offset, access);
+    auto wc = l2cpu.map_dram_2M_WC(offset, access);
+    std::vector<uint8_t> buffer(options.max_size, 0x5a);
+
+    // Small: one word, as for a flag or an index.
+    report(mode, "read32", 4, median_ns(options.trials, [&] { uc->read32(0); }));
+    report(mode, "write32+read32", 4, median_ns(options.trials, [&] {
+               uc->write32(0, 0);
+               uc->read32(0);
+           }));
+    if (!coherent) {
+        report(mode, "flush+read32", 4, median_ns(options.trials, [&] {
+                   l2cpu.flush_dram(offset, 4);
+                   uc->read32(0);
+               }));
+        report(mode, "flush+write32", 4, median_ns(options.trials, [&] {
+                   l2cpu.flush_dram(offset, 4);
+                   uc->write32(0, 0);
+               }));
+    }
+
+    // Bulk: 64 B up by factors of 4, always finishing at max_size.
+    for (size_t size : size_sweep(64, options.max_size, 4)) {
+        report(mode, "write", size, median_ns(options.trials, [&] {
+                   wc->write_block(0, buffer.data(), size);
+                   sfence();
+               }));
+        report(mode, "read", size, median_ns(options.trials, [&] { wc->read_block(0, buffer.data(), size); }));
+
+        if (!coherent) {
+            // What it takes to hand a buffer across safely in each direction.
+            report(mode, "flush+write", size, median_ns(options.trials, [&] {
+                       l2cpu.flush_dram(offset, size);
+                       wc->write_block(0, buffer.data(), size);
+                       sfence();
+                   }));
+            report(mode, "flush+read", size, median_ns(options.trials, [&] {
+                       l2cpu.flush_dram(offset, size);
+                       wc->read_block(0, buffer.data(), size);
+                   }));
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options = parse_options(argc, argv);
+
+    BlackholePciDevice device(device_path());
+    L2CPU l2cpu(device, options.x, options.y);
+
+    fmt::print("{:<12} {:<20} {:>8} {:>10} {:>10}\n", "mode", "op", "bytes", "median_ns", "MiB/s");
+    run(l2cpu, X280Access::Coherent, options);
+    run(l2cpu, X280Access::NonCoherent, options);
+
+    return 0;
+}
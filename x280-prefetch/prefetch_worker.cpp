@@ -0,0 +1,164 @@
+// Runs on the X280, under Linux.  Serves the PrefetchTuneSlot mailbox that
+// blackhole-thing's prefetch_tune drives: the host programs the L2 prefetchers,
+// asks for a workload, and this program runs it and reports rdcycle deltas.
+//
+// The slot lives in X280 DRAM at SLOT_ADDRESS and is reached through /dev/mem,
+// so that memory must be kept away from Linux (e.g. a reserved-memory node or
+// mem= on the command line).  The host writes it through the memory port,
+// which is coherent with the X280 caches.
+//
+// rdcycle from user mode needs the kernel's blessing on recent kernels:
+//   sysctl kernel.perf_user_access=2
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Must match DEFAULT_SLOT in blackhole-thing/prefetch_tune.cpp.
+static constexpr uint64_t SLOT_ADDRESS = 0x4001'2fd0'0000ULL;
+
+// Bigger than L3, so every workload streams from DRAM.
+static constexpr size_t BUFFER_SIZE = 64 << 20;
+
+// Must match PrefetchTuneSlot in blackhole-thing/src/prefetch_tuner.hpp.
+struct PrefetchTuneSlot
+{
+    static constexpr uint32_t MAGIC = 0x4e544650; // "PFTN"
+
+    uint32_t magic;      // X280
+    uint32_t sequence;   // host
+    uint32_t workload;   // host
+    uint32_t iterations; // host
+    uint32_t done;       // X280
+    uint32_t status;     // X280; 0 on success
+    uint64_t cycles;     // X280
+};
+static_assert(sizeof(PrefetchTuneSlot) == 32, "PrefetchTuneSlot layout mismatch");
+
+enum Status : uint32_t {
+    OK = 0,
+    UNKNOWN_WORKLOAD = 1,
+};
+
+static inline uint64_t cycles()
+{
+#if defined(__riscv)
+    uint64_t c;
+    asm volatile("rdcycle %0" : "=r"(c));
+    return c;
+#else
+    // So the program builds and runs on the host for a quick sanity check.
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+static inline void fence()
+{
+    __sync_synchronize();
+}
+
+// Keeps the compiler from discarding loads whose result is otherwise unused.
+static volatile uint64_t sink;
+
+// Workload IDs, as passed to prefetch_tune --workload.
+static bool run_workload(uint32_t workload, std::vector<uint64_t>& a, std::vector<uint64_t>& b)
+{
+    const size_t n = a.size();
+    uint64_t sum = 0;
+
+    switch (workload) {
+    case 0: // sequential loads
+        for (size_t i = 0; i < n; ++i) {
+            sum += a[i];
+        }
+        break;
+    case 1: // sequential stores
+        for (size_t i = 0; i < n; ++i) {
+            a[i] = i;
+        }
+        break;
+    case 2: // loads with a 256-byte stride
+        for (size_t start = 0; start < 32; ++start) {
+            for (size_t i = start; i < n; i += 32) {
+                sum += a[i];
+            }
+        }
+        break;
+    case 3: // copy: one load stream, one store stream
+        std::memcpy(b.data(), a.data(), n * sizeof(uint64_t));
+        break;
+    default:
+        return false;
+    }
+
+    sink = sum;
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    const uint64_t slot_address = argc > 1 ? std::stoull(argv[1], nullptr, 0) : SLOT_ADDRESS;
+    const uint64_t page_size = sysconf(_SC_PAGESIZE);
+    const uint64_t page = slot_address & ~(page_size - 1);
+
+    int fd = open("/dev/mem", O_RDWR | O_SYNC);
+    if (fd < 0) {
+        std::perror("open /dev/mem");
+        return 1;
+    }
+
+    void* mapping = mmap(nullptr, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, page);
+    if (mapping == MAP_FAILED) {
+        std::perror("mmap /dev/mem");
+        return 1;
+    }
+
+    auto* slot = reinterpret_cast<volatile PrefetchTuneSlot*>(static_cast<uint8_t*>(mapping) + (slot_address - page));
+
+    std::vector<uint64_t> a(BUFFER_SIZE / sizeof(uint64_t), 1);
+    std::vector<uint64_t> b(a.size(), 0);
+
+    // Carry on from whatever sequence number the host last used, so a stale
+    // request from an earlier session is not run again.
+    uint32_t sequence = slot->sequence;
+    slot->done = sequence;
+    fence();
+    slot->magic = PrefetchTuneSlot::MAGIC;
+    fence();
+
+    std::printf("Serving PrefetchTuneSlot at %#llx\n", static_cast<unsigned long long>(slot_address));
+
+    for (;;) {
+        while (slot->sequence == sequence) {
+            // Polling an uncached word; nothing else to do while idle.
+        }
+        fence();
+        sequence = slot->sequence;
+
+        const uint32_t workload = slot->workload;
+        const uint32_t iterations = slot->iterations ? slot->iterations : 1;
+
+        uint32_t status = OK;
+        const uint64_t start = cycles();
+        for (uint32_t i = 0; i < iterations && status == OK; ++i) {
+            if (!run_workload(workload, a, b)) {
+                status = UNKNOWN_WORKLOAD;
+            }
+        }
+        const uint64_t end = cycles();
+
+        slot->cycles = end - start;
+        slot->status = status;
+        fence();
+        slot->done = sequence;
+        fence();
+    }
+}